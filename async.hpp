@@ -0,0 +1,100 @@
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+// a coroutine that starts right away and runs to its end on whichever
+// threads it moves itself to, nobody waits on it
+struct IoTask {
+    struct promise_type {
+        IoTask get_return_object() {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+};
+
+// one thread for file I/O, coroutines moved onto it are resumed one after
+// the other; the ones still queued are run before it stops
+class IoExecutor {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::coroutine_handle<>> queue;
+    bool stopping = false;
+    std::thread thread;
+
+    void run() {
+        for (;;) {
+            std::coroutine_handle<> handle;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                handle = queue.front();
+                queue.pop_front();
+            }
+            handle.resume();
+        }
+    }
+
+    void push(std::coroutine_handle<> handle) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(handle);
+        }
+        cv.notify_one();
+    }
+
+public:
+    struct Schedule {
+        IoExecutor &io;
+
+        bool await_ready() const {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            io.push(handle);
+        }
+
+        void await_resume() const {}
+    };
+
+    IoExecutor() : thread(&IoExecutor::run, this) {}
+
+    ~IoExecutor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_one();
+        thread.join();
+    }
+
+    IoExecutor(const IoExecutor &) = delete;
+    IoExecutor &operator=(const IoExecutor &) = delete;
+
+    // co_await io.schedule() continues the coroutine on the I/O thread
+    Schedule schedule() {
+        return {*this};
+    }
+};
@@ -0,0 +1,387 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "engine.hpp"
+#include "gamefield.hpp"
+#include "kernels.hpp"
+#include "pages.hpp"
+#include "threadpool.hpp"
+
+// bytes of the two row windows a strip is stepped in when time blocking,
+// about what the L2 cache of a core holds
+#define TIME_BLOCK_CACHE (1 << 20)
+
+// row-major, 64 cells per word, bit (x % 64) of word (x / 64) is cell x
+class BitField : public Engine {
+    size_t n;
+    size_t words;
+    uint64_t last_mask;
+    PageVector<uint64_t> cells;
+    // per strip: original rows bordering it, original previous row, result row
+    std::vector<uint64_t> halos, scratch;
+    std::vector<uint64_t> edge_rows;
+    Rule life_rule;
+    Topology edges;
+    LifeRowFn life_row;
+    ThreadPool *pool;
+    unsigned time_block;
+    // per strip when time blocking: the time_block rows above and below it
+    std::vector<uint64_t> block_halos;
+    TrackedHash board_hash;
+
+    uint64_t &word(size_t x, size_t y) {
+        return cells[y * words + (x >> 6)];
+    }
+
+    // rows are updated in place, only the original of the previous row is
+    // kept; returns the keys of the flipped cells when the hash is tracked
+    uint64_t stepRows(size_t begin, size_t end, const uint64_t *above, const uint64_t *below,
+            uint64_t *prev, uint64_t *out)
+    {
+        uint64_t keys = 0;
+        for (size_t y = begin; y < end; ++y) {
+            uint64_t *row = &cells[y * words];
+            const uint64_t *up = y == begin ? above : prev;
+            const uint64_t *down = y + 1 == end ? below : row + words;
+            life_row(up, row, down, out, words, life_rule);
+            if (edges == Topology::Torus) {
+                lifeRowWrap(up, row, down, out, words, n, life_rule);
+            }
+            out[words - 1] &= last_mask;
+            if (board_hash.tracking()) {
+                for (size_t i = 0; i < words; ++i) {
+                    keys ^= zobristWord(row[i] ^ out[i], i * 64, y);
+                }
+            }
+            std::memcpy(prev, row, words * sizeof(uint64_t));
+            std::memcpy(row, out, words * sizeof(uint64_t));
+        }
+        return keys;
+    }
+
+    // halo rows past the top and bottom of the board, dead or the rows
+    // from the other side on a torus
+    void copyEdgeRows(uint64_t *above, uint64_t *below) {
+        if (edges == Topology::Torus) {
+            std::memcpy(above, &cells[(n - 1) * words], words * sizeof(uint64_t));
+            std::memcpy(below, &cells[0], words * sizeof(uint64_t));
+        } else {
+            std::fill(above, above + words, 0);
+            std::fill(below, below + words, 0);
+        }
+    }
+
+    // the rows bordering each strip are copied before any strip is stepped
+    void stepParallel() {
+        size_t strips = std::min(n, pool->size() * 4);
+        size_t rows = n / strips;
+        strips = n / rows;
+        halos.resize(strips * 2 * words);
+        scratch.resize(strips * 2 * words);
+        copyEdgeRows(&halos[0], &halos[(strips * 2 - 1) * words]);
+        for (size_t s = 0; s < strips; ++s) {
+            uint64_t *above = &halos[s * 2 * words], *below = above + words;
+            if (s) {
+                std::memcpy(above, &cells[(s * rows - 1) * words], words * sizeof(uint64_t));
+            }
+            if (s + 1 < strips) {
+                std::memcpy(below, &cells[(s + 1) * rows * words], words * sizeof(uint64_t));
+            }
+        }
+        std::atomic<uint64_t> keys{0};
+        pool->parallelFor(strips, [&](size_t s) {
+            uint64_t *above = &halos[s * 2 * words], *prev = &scratch[s * 2 * words];
+            // the last strip takes the rows left over
+            size_t end = s + 1 == strips ? n : (s + 1) * rows;
+            keys.fetch_xor(stepRows(s * rows, end, above, above + words, prev, prev + words),
+                std::memory_order_relaxed);
+        });
+        board_hash.flip(keys);
+    }
+
+    // board row y, or the row of the other side on a torus; null past the
+    // edge of a dead board
+    const uint64_t *boardRow(int64_t y) const {
+        if (edges == Topology::Torus) {
+            return &cells[((y % (int64_t)n + n) % n) * words];
+        }
+        return y >= 0 && y < (int64_t)n ? &cells[y * words] : nullptr;
+    }
+
+    // rows [begin, end) with k rows above and below are copied into a
+    // window and stepped k times in it, every generation leaves one row
+    // less valid at either end; rows past the edge of a dead board stay dead
+    uint64_t stepBlock(size_t begin, size_t end, unsigned k, const uint64_t *halo) {
+        size_t len = end - begin + 2 * k;
+        thread_local std::vector<uint64_t> windows;
+        windows.resize(2 * len * words);
+        uint64_t *src = windows.data(), *dst = src + len * words;
+        std::memcpy(src, halo, k * words * sizeof(uint64_t));
+        std::memcpy(src + k * words, &cells[begin * words], (end - begin) * words * sizeof(uint64_t));
+        std::memcpy(src + (len - k) * words, halo + k * words, k * words * sizeof(uint64_t));
+        for (unsigned g = 1; g <= k; ++g) {
+            for (size_t r = g; r < len - g; ++r) {
+                int64_t y = (int64_t)(begin + r) - k;
+                uint64_t *out = dst + r * words;
+                if (edges != Topology::Torus && (y < 0 || y >= (int64_t)n)) {
+                    std::fill(out, out + words, 0);
+                    continue;
+                }
+                const uint64_t *a = src + (r - 1) * words, *b = a + words, *c = b + words;
+                life_row(a, b, c, out, words, life_rule);
+                if (edges == Topology::Torus) {
+                    lifeRowWrap(a, b, c, out, words, n, life_rule);
+                }
+                out[words - 1] &= last_mask;
+            }
+            std::swap(src, dst);
+        }
+        uint64_t keys = 0;
+        for (size_t y = begin; y < end; ++y) {
+            uint64_t *row = &cells[y * words];
+            const uint64_t *result = src + (y - begin + k) * words;
+            if (board_hash.tracking()) {
+                for (size_t i = 0; i < words; ++i) {
+                    keys ^= zobristWord(row[i] ^ result[i], i * 64, y);
+                }
+            }
+            std::memcpy(row, result, words * sizeof(uint64_t));
+        }
+        return keys;
+    }
+
+    // k generations per pass over the board: the halos of all strips are
+    // copied first, then every strip is stepped on its own, in parallel
+    // on the pool; strips are sized so their windows stay in cache
+    void stepTimeBlocked(unsigned k) {
+        size_t rows = std::max<size_t>(TIME_BLOCK_CACHE / (2 * words * sizeof(uint64_t)), 4 * k);
+        rows = std::min(rows - std::min<size_t>(rows / 2, 2 * k), n);
+        size_t strips = (n + rows - 1) / rows;
+        if (pool && pool->size() > 1) {
+            // enough strips to keep the workers busy
+            strips = std::max(strips, std::min(n / std::max<size_t>(k, 1), pool->size() * 4));
+            rows = (n + strips - 1) / strips;
+            strips = (n + rows - 1) / rows;
+        }
+        block_halos.resize(strips * 2 * k * words);
+        for (size_t s = 0; s < strips; ++s) {
+            int64_t begin = s * rows, end = std::min(n, (s + 1) * rows);
+            uint64_t *halo = &block_halos[s * 2 * k * words];
+            for (unsigned i = 0; i < 2 * k; ++i) {
+                const uint64_t *row = boardRow(i < k ? begin - k + i : end + i - k);
+                if (row) {
+                    std::memcpy(halo + i * words, row, words * sizeof(uint64_t));
+                } else {
+                    std::fill(halo + i * words, halo + (i + 1) * words, 0);
+                }
+            }
+        }
+        std::atomic<uint64_t> keys{0};
+        auto strip = [&](size_t s) {
+            keys.fetch_xor(stepBlock(s * rows, std::min(n, (s + 1) * rows), k,
+                &block_halos[s * 2 * k * words]), std::memory_order_relaxed);
+        };
+        if (pool && pool->size() > 1) {
+            pool->parallelFor(strips, strip);
+        } else {
+            for (size_t s = 0; s < strips; ++s) {
+                strip(s);
+            }
+        }
+        board_hash.flip(keys);
+    }
+
+public:
+    BitField(size_t size, const EngineOptions &options = {}) :
+        n(size), life_rule(options.rule), edges(options.topology),
+        life_row(lifeRowFn(options.rule)), pool(options.pool),
+        time_block(std::max(options.time_block, 1u))
+    {
+        checkRule(options.rule);
+        if (size == 0 || (size & (size - 1))) {
+            throw std::invalid_argument("size needs to be power of 2");
+        }
+        if (size > 65536) {
+            throw std::invalid_argument("size >65536 not supported");
+        }
+        words = (size + 63) / 64;
+        last_mask = size % 64 ? (1ull << (size % 64)) - 1 : ~0ull;
+        cells.assign(words * size, 0);
+        scratch.assign(2 * words, 0);
+        edge_rows.assign(2 * words, 0);
+    }
+
+    size_t size() const override {
+        return n;
+    }
+
+    Rule rule() const override {
+        return life_rule;
+    }
+
+    Topology topology() const override {
+        return edges;
+    }
+
+    bool get(int64_t x, int64_t y) const override {
+        return (cells[y * words + (x >> 6)] >> (x & 63)) & 1;
+    }
+
+    void toggle(int64_t x, int64_t y) override {
+        word(x, y) ^= 1ull << (x & 63);
+        board_hash.flip(zobristKey(x, y));
+    }
+
+    void clear() override {
+        std::fill(cells.begin(), cells.end(), 0);
+        board_hash.invalidate();
+    }
+
+    // every word is one output of the generator, so strips of rows are
+    // filled in parallel
+    void populateRandom(const SoupOptions &soup) override {
+        auto rows = [&](size_t begin, size_t end) {
+            for (size_t y = begin; y < end; ++y) {
+                for (size_t i = 0; i < words; ++i) {
+                    cells[y * words + i] = soupWord(soup, y, i, n);
+                }
+            }
+        };
+        if (pool && pool->size() > 1) {
+            size_t strips = std::min(n, pool->size() * 4);
+            size_t per = n / strips;
+            pool->parallelFor(strips, [&](size_t s) {
+                rows(s * per, s + 1 == strips ? n : (s + 1) * per);
+            });
+        } else {
+            rows(0, n);
+        }
+        board_hash.invalidate();
+    }
+
+    void setAlive(const uint32_t *idxs, size_t len) override {
+        for (size_t i = 0; i < len; ++i) {
+            uint16_t x, y;
+            deinterleaveXY(idxs[i], x, y);
+            if (x < n && y < n) {
+                word(x, y) |= 1ull << (x & 63);
+            }
+        }
+        board_hash.invalidate();
+    }
+
+    void getAlive(std::vector<uint32_t> &idxs) const override {
+        size_t first = idxs.size();
+        for (size_t y = 0; y < n; ++y) {
+            for (size_t i = 0; i < words; ++i) {
+                uint64_t w = cells[y * words + i];
+                while (w) {
+                    size_t x = (i << 6) + __builtin_ctzll(w);
+                    idxs.push_back(interleaveXY(x, y));
+                    w &= w - 1;
+                }
+            }
+        }
+        std::sort(idxs.begin() + first, idxs.end());
+    }
+
+    uint64_t population() const override {
+        uint64_t count = 0;
+        for (uint64_t w : cells) {
+            count += __builtin_popcountll(w);
+        }
+        return count;
+    }
+
+    uint64_t hash() const override {
+        return board_hash.get([&] { return Engine::hash(); });
+    }
+
+    std::unique_ptr<Engine> clone() const override {
+        EngineOptions options;
+        options.rule = life_rule;
+        options.topology = edges;
+        auto copy = std::make_unique<BitField>(n, options);
+        copy->cells = cells;
+        return copy;
+    }
+
+    void readRegion(int64_t x0, int64_t y0, size_t w, size_t h,
+            uint64_t *bits, size_t stride) const override
+    {
+        for (size_t dy = 0; dy < h; ++dy) {
+            int64_t y = y0 + dy;
+            if (y < 0 || y >= (int64_t)n) {
+                continue;
+            }
+            const uint64_t *row = &cells[y * words];
+            for (size_t j = 0; j < stride && j * 64 < w; ++j) {
+                // 64 cells from x, spanning at most two words of the row
+                int64_t x = x0 + (int64_t)j * 64;
+                int64_t i = x >> 6, shift = x & 63;
+                uint64_t lo = i >= 0 && i < (int64_t)words ? row[i] : 0;
+                uint64_t hi = i + 1 >= 0 && i + 1 < (int64_t)words ? row[i + 1] : 0;
+                uint64_t w64 = shift ? (lo >> shift) | (hi << (64 - shift)) : lo;
+                size_t left = w - j * 64;
+                if (left < 64) {
+                    w64 &= (1ull << left) - 1;
+                }
+                bits[dy * stride + j] = w64;
+            }
+        }
+    }
+
+    void writeRegion(int64_t x0, int64_t y0, size_t w, size_t h,
+            const uint64_t *bits, size_t stride) override
+    {
+        board_hash.invalidate();
+        if (x0 & 63 || x0 < 0) {
+            Engine::writeRegion(x0, y0, w, h, bits, stride);
+            return;
+        }
+        // word aligned, whole words are copied
+        for (size_t dy = 0; dy < h; ++dy) {
+            int64_t y = y0 + dy;
+            if (y < 0 || y >= (int64_t)n) {
+                continue;
+            }
+            uint64_t *row = &cells[y * words];
+            for (size_t j = 0; j < stride && j * 64 < w && (size_t)(x0 >> 6) + j < words; ++j) {
+                size_t left = w - j * 64;
+                uint64_t mask = left < 64 ? (1ull << left) - 1 : ~0ull;
+                if ((size_t)(x0 >> 6) + j + 1 == words) {
+                    mask &= last_mask;
+                }
+                uint64_t &word = row[(x0 >> 6) + j];
+                word = (word & ~mask) | (bits[dy * stride + j] & mask);
+            }
+        }
+    }
+
+    uint64_t generationsPerStep() const override {
+        return time_block;
+    }
+
+    void step() override {
+        if (time_block > 1) {
+            stepTimeBlocked(time_block);
+            return;
+        }
+        stepSingle();
+    }
+
+    // one generation whatever the time block, to end on an exact count
+    void stepSingle() {
+        if (pool && pool->size() > 1) {
+            stepParallel();
+            return;
+        }
+        copyEdgeRows(edge_rows.data(), edge_rows.data() + words);
+        board_hash.flip(stepRows(0, n, edge_rows.data(), edge_rows.data() + words,
+            scratch.data(), scratch.data() + words));
+    }
+};
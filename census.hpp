@@ -0,0 +1,507 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "engine.hpp"
+#include "cycles.hpp"
+#include "engines.hpp"
+#include "gamefield.hpp"
+#include "soup.hpp"
+#include "sparse.hpp"
+#include "threadpool.hpp"
+
+#define CENSUS_SOUP_SIZE_INIT 16
+#define CENSUS_GENERATIONS_INIT 20000
+#define CENSUS_WECHSLER "0123456789abcdefghijklmnopqrstuvwxyz"
+
+struct CensusOptions {
+    uint64_t soups = 0;
+    // side of the random square in the middle of the board
+    size_t soup_size = CENSUS_SOUP_SIZE_INIT;
+    // soup i is the square of the soup seeded from this seed and i
+    SoupOptions soup;
+    // soups that have not settled by then are counted as unstable
+    uint64_t max_generations = CENSUS_GENERATIONS_INIT;
+};
+
+typedef std::vector<std::pair<int64_t, int64_t>> CellList;
+
+// common objects by apgcode
+static const std::pair<const char *, const char *> CENSUS_NAMES[] = {
+    {"xs4_33", "block"}, {"xp2_7", "blinker"}, {"xs6_696", "beehive"},
+    {"xs7_2596", "loaf"}, {"xs5_253", "boat"}, {"xs6_356", "ship"},
+    {"xs4_252", "tub"}, {"xs8_6996", "pond"}, {"xq4_153", "glider"},
+    {"xp2_7e", "toad"}, {"xp2_318c", "beacon"}, {"xs7_25ac", "long boat"},
+    {"xs6_25a4", "barge"}, {"xs8_3pe", "snake"}, {"xs12_g8o653z11", "ship-tie"},
+};
+
+// cells moved so that the bounding box starts at (0, 0), sorted
+inline CellList normalized(CellList cells) {
+    int64_t x0 = INT64_MAX, y0 = INT64_MAX;
+    for (const auto &cell : cells) {
+        x0 = std::min(x0, cell.first);
+        y0 = std::min(y0, cell.second);
+    }
+    for (auto &cell : cells) {
+        cell.first -= x0;
+        cell.second -= y0;
+    }
+    std::sort(cells.begin(), cells.end());
+    return cells;
+}
+
+// extended Wechsler format: strips of 5 rows from the top separated by z,
+// one character per column with the top row as bit 0, runs of empty
+// columns as w (2), x (3) and y0..yz (4 to 39)
+inline std::string wechsler(const CellList &cells) {
+    int64_t w = 0, h = 0;
+    for (const auto &cell : cells) {
+        w = std::max(w, cell.first + 1);
+        h = std::max(h, cell.second + 1);
+    }
+    std::vector<uint8_t> columns((h + 4) / 5 * w, 0);
+    for (const auto &cell : cells) {
+        columns[cell.second / 5 * w + cell.first] |= 1 << (cell.second % 5);
+    }
+    std::string code;
+    for (int64_t strip = 0; strip * 5 < h; ++strip) {
+        if (strip) {
+            code += 'z';
+        }
+        int64_t end = w;
+        while (end > 0 && !columns[strip * w + end - 1]) {
+            --end;
+        }
+        for (int64_t x = 0; x < end;) {
+            if (columns[strip * w + x]) {
+                code += CENSUS_WECHSLER[columns[strip * w + x++]];
+                continue;
+            }
+            int64_t run = 0;
+            while (!columns[strip * w + x + run]) {
+                ++run;
+            }
+            x += run;
+            while (run > 0) {
+                int64_t take = std::min<int64_t>(run, 39);
+                if (take == 1) {
+                    code += '0';
+                } else if (take == 2) {
+                    code += 'w';
+                } else if (take == 3) {
+                    code += 'x';
+                } else {
+                    code += 'y';
+                    code += CENSUS_WECHSLER[take - 4];
+                }
+                run -= take;
+            }
+        }
+    }
+    return code;
+}
+
+// shortest and then smallest code over the 8 orientations
+inline std::string canonicalCode(const CellList &cells) {
+    std::string best;
+    for (int t = 0; t < 8; ++t) {
+        CellList moved;
+        for (auto [x, y] : cells) {
+            if (t & 4) {
+                std::swap(x, y);
+            }
+            moved.emplace_back(t & 1 ? -x : x, t & 2 ? -y : y);
+        }
+        std::string code = wechsler(normalized(moved));
+        if (best.empty() || code.size() < best.size() || (code.size() == best.size() && code < best)) {
+            best = code;
+        }
+    }
+    return best;
+}
+
+// counts of objects by apgcode: xs<cells> still lifes, xp<period>
+// oscillators, xq<period> spaceships, zz<cells> objects that do not repeat
+// on their own within CYCLE_HISTORY generations
+class Census {
+    Rule rule;
+    std::map<std::string, uint64_t> counts;
+    // objects that ran into the edge of the board, mostly gliders
+    uint64_t escaped = 0;
+    // codes of objects seen before, keyed by the normalized cells
+    std::map<CellList, std::string> known;
+
+    // steps the object on its own plane until it repeats up to translation,
+    // the plane is wide enough that a spaceship stays on the board
+    std::string identify(const CellList &cells) {
+        int64_t extent = 0;
+        for (const auto &cell : cells) {
+            extent = std::max({extent, cell.first + 1, cell.second + 1});
+        }
+        EngineOptions options;
+        options.rule = rule;
+        size_t side = std::min<size_t>(extent + 2 * (CYCLE_HISTORY + 1), 65536);
+        SparseField plane(side, options);
+        int64_t offset = CYCLE_HISTORY + 1;
+        for (auto [x, y] : cells) {
+            plane.toggle(x + offset, y + offset);
+        }
+        std::string best = canonicalCode(cells);
+        std::vector<uint32_t> alive;
+        for (uint64_t period = 1; period <= CYCLE_HISTORY; ++period) {
+            plane.step();
+            alive.clear();
+            plane.getAlive(alive);
+            if (alive.empty()) {
+                break;
+            }
+            CellList phase;
+            for (uint32_t idx : alive) {
+                uint16_t x, y;
+                deinterleaveXY(idx, x, y);
+                phase.emplace_back(x, y);
+            }
+            CellList shape = normalized(phase);
+            if (shape == cells) {
+                auto origin = *std::min_element(phase.begin(), phase.end());
+                bool moved = origin != std::make_pair(cells.front().first + offset,
+                    cells.front().second + offset);
+                std::string kind = moved ? "xq" : period == 1 ? "xs" : "xp";
+                return kind + std::to_string(period == 1 ? cells.size() : period) + "_" + best;
+            }
+            std::string code = canonicalCode(shape);
+            if (code.size() < best.size() || (code.size() == best.size() && code < best)) {
+                best = code;
+            }
+        }
+        return "zz" + std::to_string(cells.size()) + "_" + canonicalCode(cells);
+    }
+
+    // the cells and the CYCLE_HISTORY generations after them on an open
+    // plane around the board of size n, each generation sorted
+    std::vector<CellList> evolve(const CellList &cells, size_t n) const {
+        EngineOptions options;
+        options.rule = rule;
+        // nothing gets further than a cell per generation
+        int64_t offset = CYCLE_HISTORY + 1;
+        SparseField plane(std::min<size_t>(n + 2 * offset, 65536), options);
+        for (auto [x, y] : cells) {
+            plane.toggle(x + offset, y + offset);
+        }
+        std::vector<CellList> phases = {cells};
+        std::sort(phases[0].begin(), phases[0].end());
+        std::vector<uint32_t> alive;
+        for (uint64_t t = 1; t <= CYCLE_HISTORY; ++t) {
+            plane.step();
+            alive.clear();
+            plane.getAlive(alive);
+            CellList phase;
+            for (uint32_t idx : alive) {
+                uint16_t x, y;
+                deinterleaveXY(idx, x, y);
+                phase.emplace_back(x - offset, y - offset);
+            }
+            std::sort(phase.begin(), phase.end());
+            phases.push_back(std::move(phase));
+        }
+        return phases;
+    }
+
+    // the orthogonally connected parts of a group of cells
+    static std::vector<CellList> orthogonalParts(const CellList &cells) {
+        std::map<std::pair<int64_t, int64_t>, bool> left;
+        for (const auto &cell : cells) {
+            left[cell] = true;
+        }
+        std::vector<CellList> parts;
+        for (const auto &start : cells) {
+            if (!left[start]) {
+                continue;
+            }
+            left[start] = false;
+            CellList part = {start};
+            for (size_t k = 0; k < part.size(); ++k) {
+                auto [x, y] = part[k];
+                const std::pair<int64_t, int64_t> next[] = {{x - 1, y}, {x + 1, y}, {x, y - 1}, {x, y + 1}};
+                for (const auto &cell : next) {
+                    auto it = left.find(cell);
+                    if (it != left.end() && it->second) {
+                        it->second = false;
+                        part.push_back(cell);
+                    }
+                }
+            }
+            parts.push_back(std::move(part));
+        }
+        return parts;
+    }
+
+    // objects are the groups that evolve alone as they do together, as
+    // apgsearch separates them: the groups start out orthogonally
+    // connected, and at the first generation where the groups stepped on
+    // their own do not add up to all of them stepped together, the groups
+    // with cells around a cell that differs are merged and stepped again.
+    // that joins the pieces of one object and keeps neighbours apart that
+    // do not interact
+    std::vector<CellList> separate(std::vector<CellList> groups, size_t n) const {
+        CellList all;
+        for (const CellList &group : groups) {
+            all.insert(all.end(), group.begin(), group.end());
+        }
+        std::vector<CellList> joint = evolve(all, n);
+        for (;;) {
+            std::vector<std::vector<CellList>> alone;
+            for (const CellList &group : groups) {
+                alone.push_back(evolve(group, n));
+            }
+            // the groups with a cell at each position, per generation
+            typedef std::map<std::pair<int64_t, int64_t>, std::vector<size_t>> Owners;
+            auto ownersAt = [&](uint64_t t) {
+                Owners owners;
+                for (size_t g = 0; g < groups.size(); ++g) {
+                    for (const auto &cell : alone[g][t]) {
+                        owners[cell].push_back(g);
+                    }
+                }
+                return owners;
+            };
+            std::vector<size_t> parent(groups.size());
+            for (size_t g = 0; g < parent.size(); ++g) {
+                parent[g] = g;
+            }
+            auto find = [&](size_t g) {
+                while (parent[g] != g) {
+                    g = parent[g] = parent[parent[g]];
+                }
+                return g;
+            };
+            bool merged = false;
+            Owners before = ownersAt(0);
+            for (uint64_t t = 1; t <= CYCLE_HISTORY && !merged; ++t) {
+                Owners owners = ownersAt(t);
+                CellList differing;
+                for (const auto &[cell, gs] : owners) {
+                    if (gs.size() > 1 || !std::binary_search(joint[t].begin(), joint[t].end(), cell)) {
+                        differing.push_back(cell);
+                    }
+                }
+                for (const auto &cell : joint[t]) {
+                    if (!owners.count(cell)) {
+                        differing.push_back(cell);
+                    }
+                }
+                for (auto [x, y] : differing) {
+                    // the groups that decided the cell
+                    size_t first = SIZE_MAX;
+                    for (int dy = -1; dy <= 1; ++dy) {
+                        for (int dx = -1; dx <= 1; ++dx) {
+                            auto it = before.find({x + dx, y + dy});
+                            if (it == before.end()) {
+                                continue;
+                            }
+                            for (size_t g : it->second) {
+                                if (first == SIZE_MAX) {
+                                    first = find(g);
+                                } else if (find(g) != first) {
+                                    parent[find(g)] = first;
+                                    merged = true;
+                                }
+                            }
+                        }
+                    }
+                }
+                before = std::move(owners);
+            }
+            if (!merged) {
+                return groups;
+            }
+            std::vector<CellList> joined(groups.size());
+            for (size_t g = 0; g < groups.size(); ++g) {
+                CellList &into = joined[find(g)];
+                into.insert(into.end(), groups[g].begin(), groups[g].end());
+            }
+            groups.clear();
+            for (CellList &group : joined) {
+                if (!group.empty()) {
+                    groups.push_back(std::move(group));
+                }
+            }
+        }
+    }
+
+public:
+    Census(const Rule &rule) : rule(rule) {}
+
+    // 8-connected groups of live cells that reach the edge have escaped, the
+    // rest is separated into objects by how it evolves
+    void add(const Engine &field) {
+        size_t n = field.size(), stride = (n + 63) / 64;
+        std::vector<uint64_t> bits(stride * n, 0);
+        field.readRegion(0, 0, n, n, bits.data(), stride);
+        auto take = [&](int64_t x, int64_t y) {
+            if (x < 0 || y < 0 || x >= (int64_t)n || y >= (int64_t)n) {
+                return false;
+            }
+            uint64_t &word = bits[y * stride + (x >> 6)], bit = 1ull << (x & 63);
+            bool alive = word & bit;
+            word &= ~bit;
+            return alive;
+        };
+        std::vector<CellList> groups;
+        for (size_t i = 0; i < bits.size(); ++i) {
+            while (bits[i]) {
+                int64_t x = (i % stride) * 64 + __builtin_ctzll(bits[i]), y = i / stride;
+                take(x, y);
+                CellList cells = {{x, y}};
+                bool edge = false;
+                for (size_t k = 0; k < cells.size(); ++k) {
+                    auto [cx, cy] = cells[k];
+                    edge |= cx == 0 || cy == 0 || cx + 1 == (int64_t)n || cy + 1 == (int64_t)n;
+                    for (int dy = -1; dy <= 1; ++dy) {
+                        for (int dx = -1; dx <= 1; ++dx) {
+                            if (take(cx + dx, cy + dy)) {
+                                cells.emplace_back(cx + dx, cy + dy);
+                            }
+                        }
+                    }
+                }
+                // what reached the edge no longer moves as it would on the plane
+                if (edge) {
+                    ++escaped;
+                    continue;
+                }
+                for (CellList &part : orthogonalParts(cells)) {
+                    groups.push_back(std::move(part));
+                }
+            }
+        }
+        if (groups.empty()) {
+            return;
+        }
+        for (CellList &cells : separate(std::move(groups), n)) {
+            cells = normalized(cells);
+            auto it = known.find(cells);
+            if (it == known.end()) {
+                it = known.emplace(cells, identify(cells)).first;
+            }
+            ++counts[it->second];
+        }
+    }
+
+    void merge(const Census &other) {
+        for (const auto &entry : other.counts) {
+            counts[entry.first] += entry.second;
+        }
+        escaped += other.escaped;
+    }
+
+    uint64_t escapedObjects() const {
+        return escaped;
+    }
+
+    const std::map<std::string, uint64_t> &objects() const {
+        return counts;
+    }
+};
+
+// the random square of soup index, the same for any number of workers
+inline void placeSoup(Engine &field, const CensusOptions &census, uint64_t index) {
+    SoupOptions soup = census.soup;
+    soup.seed = soupRandom(census.soup.seed, index);
+    size_t side = std::min(census.soup_size, field.size());
+    size_t stride = (side + 63) / 64;
+    std::vector<uint64_t> bits(stride * side);
+    for (size_t y = 0; y < side; ++y) {
+        for (size_t j = 0; j < stride; ++j) {
+            bits[y * stride + j] = soupWord(soup, y, j, side);
+        }
+    }
+    int64_t offset = (field.size() - side) / 2;
+    field.clear();
+    field.writeRegion(offset, offset, side, side, bits.data(), stride);
+}
+
+// runs soups on every worker of the pool, each with an engine of its own
+// that is reused for all the soups it takes; soups run until they cycle
+inline int runCensus(const std::string &engine_name, size_t size, const EngineOptions &options,
+        const CensusOptions &census)
+{
+    // the soups are the parallel work, every engine steps on one thread
+    EngineOptions field_options = options;
+    field_options.pool = nullptr;
+    size_t workers = options.pool ? options.pool->size() : 1;
+    std::vector<std::unique_ptr<Engine>> fields;
+    try {
+        for (size_t w = 0; w < workers; ++w) {
+            fields.push_back(makeEngine(engine_name, size, field_options));
+        }
+    } catch (const std::invalid_argument &e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    std::vector<Census> results(workers, Census(options.rule));
+    std::atomic<uint64_t> next{0}, unstable{0}, generations{0};
+    auto start = std::chrono::steady_clock::now();
+    auto work = [&](size_t w) {
+        Engine &field = *fields[w];
+        CycleDetector cycles(true);
+        for (uint64_t soup; (soup = next.fetch_add(1)) < census.soups;) {
+            placeSoup(field, census, soup);
+            cycles.reset();
+            uint64_t generation = 0;
+            cycles.update(field, 0);
+            while (!cycles.shouldStop() && generation < census.max_generations) {
+                field.step();
+                generation += field.generationsPerStep();
+                cycles.update(field, generation);
+            }
+            if (!cycles.shouldStop()) {
+                ++unstable;
+            }
+            generations += generation;
+            results[w].add(field);
+        }
+    };
+    if (options.pool) {
+        options.pool->parallelFor(workers, work);
+    } else {
+        work(0);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Census total(options.rule);
+    for (const Census &result : results) {
+        total.merge(result);
+    }
+    std::vector<std::pair<uint64_t, std::string>> sorted;
+    uint64_t objects = 0;
+    for (const auto &entry : total.objects()) {
+        sorted.emplace_back(entry.second, entry.first);
+        objects += entry.second;
+    }
+    std::sort(sorted.rbegin(), sorted.rend());
+    std::printf("engine=%s size=%zu soups=%llu soup-size=%zu seed=%llu density=%g seconds=%.3f "
+        "soups/hour=%.0f generations=%llu unstable=%llu objects=%llu escaped=%llu\n",
+        engine_name.c_str(), size, (unsigned long long)census.soups, census.soup_size,
+        (unsigned long long)census.soup.seed, census.soup.density, seconds,
+        census.soups / seconds * 3600,
+        (unsigned long long)generations, (unsigned long long)unstable,
+        (unsigned long long)objects, (unsigned long long)total.escapedObjects());
+    for (const auto &[count, code] : sorted) {
+        const char *name = "";
+        for (const auto &known : CENSUS_NAMES) {
+            if (code == known.first) {
+                name = known.second;
+            }
+        }
+        std::printf("%llu %s %s\n", (unsigned long long)count, code.c_str(), name);
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "engine.hpp"
+#include "patterns.hpp"
+
+#define CHECKPOINT_EVERY_INIT 10000
+
+struct CheckpointOptions {
+    // no checkpoints when empty
+    std::string path;
+    uint64_t every = CHECKPOINT_EVERY_INIT;
+    bool compress = false;
+    // start from the checkpoint if there is one
+    bool resume = false;
+
+    bool canResume() const {
+        return resume && !path.empty() && std::filesystem::exists(patternPath(path));
+    }
+};
+
+// saves a copy of the field every so many generations on a background
+// thread; at most one copy waits to be written, a newer one replaces it
+class Checkpointer {
+    std::string path;
+    uint64_t every;
+    bool compress;
+    uint64_t next;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::unique_ptr<Engine> pending;
+    uint64_t pending_generation = 0;
+    bool stopping = false;
+    std::thread thread;
+
+    void run() {
+        for (;;) {
+            std::unique_ptr<Engine> field;
+            uint64_t generation;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return stopping || pending; });
+                if (!pending) {
+                    return;
+                }
+                field = std::move(pending);
+                generation = pending_generation;
+            }
+            std::string temp = tempPatternPath(path);
+            // a failed write keeps the last good checkpoint
+            if (!savePattern(temp, *field, generation, compress)
+                    || std::rename(temp.c_str(), path.c_str())) {
+                std::cerr << "Error: unable to write checkpoint " << path << std::endl;
+                std::remove(temp.c_str());
+            }
+        }
+    }
+
+public:
+    // .gol is appended like for saved files, the extension picks the format
+    Checkpointer(const CheckpointOptions &options, uint64_t generation = 0) :
+        path(patternPath(options.path)), every(options.every ? options.every : 1),
+        compress(options.compress),
+        next(generation - generation % this->every + this->every)
+    {
+        thread = std::thread(&Checkpointer::run, this);
+    }
+
+    // the last pending copy is still written
+    ~Checkpointer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_one();
+        thread.join();
+    }
+
+    // only copies the field on the calling thread, writing happens later;
+    // the copy is a plain clone rather than a copy-on-write snapshot, as the
+    // engines step their buffers in place, so the step it falls between
+    // takes as long as copying the board (about 0.15 s for swar at 65536)
+    void update(const Engine &field, uint64_t generation) {
+        if (generation < next) {
+            return;
+        }
+        next = generation - generation % every + every;
+        std::unique_ptr<Engine> copy = field.clone();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = std::move(copy);
+            pending_generation = generation;
+        }
+        cv.notify_one();
+    }
+};
@@ -0,0 +1,976 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "engine.hpp"
+#include "gamefield.hpp"
+#include "kernels.hpp"
+#include "pages.hpp"
+#include "threadpool.hpp"
+
+// boards of the cluster engine are split across nodes, so they can be
+// larger than on one host
+#define CLUSTER_SIZE_MAX (1u << 20)
+#define CLUSTER_CONNECT_TRIES 300
+#define CLUSTER_CONNECT_WAIT_MS 100
+#define CLUSTER_MAGIC 0x54534c43 // "CLST"
+
+// messages from the coordinator to the other nodes, integers are native
+// so all nodes need the same byte order
+enum ClusterOp {
+    CLUSTER_CREATE, CLUSTER_DROP, CLUSTER_CLONE, CLUSTER_CLEAR, CLUSTER_POPULATE,
+    CLUSTER_TOGGLE, CLUSTER_SET_ALIVE, CLUSTER_GET_ALIVE, CLUSTER_POPULATION, CLUSTER_HASH,
+    CLUSTER_READ, CLUSTER_WRITE, CLUSTER_DENSITY, CLUSTER_STEP, CLUSTER_QUIT,
+};
+
+struct ClusterMessage {
+    uint32_t op;
+    // of the board on the nodes, every engine made on the coordinator has one
+    uint32_t id;
+    int64_t args[6];
+};
+
+// first message on every connection
+struct ClusterHello {
+    uint32_t magic;
+    // 0 for the halo link from the node above, 1 for the coordinator link
+    uint32_t kind;
+    uint32_t rank, nodes;
+};
+
+struct ClusterNode {
+    std::string host, port;
+};
+
+// host:port,host:port,... in order of rank
+inline bool parseClusterNodes(const std::string &text, std::vector<ClusterNode> &nodes) {
+    nodes.clear();
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = std::min(text.find(',', start), text.size());
+        std::string item = text.substr(start, end - start);
+        size_t colon = item.rfind(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == item.size()) {
+            std::cerr << "Error: cluster node " << item << " is not host:port" << std::endl;
+            return false;
+        }
+        nodes.push_back({item.substr(0, colon), item.substr(colon + 1)});
+        start = end + 1;
+    }
+    return !nodes.empty();
+}
+
+[[noreturn]] inline void clusterLost() {
+    std::cerr << "Error: lost the connection to a cluster node" << std::endl;
+    std::exit(1);
+}
+
+inline bool sendAll(int fd, const void *data, size_t len) {
+    const char *p = (const char *)data;
+    while (len) {
+        ssize_t k = send(fd, p, len, MSG_NOSIGNAL);
+        if (k < 0 && errno == EINTR) {
+            continue;
+        } else if (k <= 0) {
+            return false;
+        }
+        p += k;
+        len -= k;
+    }
+    return true;
+}
+
+inline bool recvAll(int fd, void *data, size_t len) {
+    char *p = (char *)data;
+    while (len) {
+        ssize_t k = recv(fd, p, len, 0);
+        if (k < 0 && errno == EINTR) {
+            continue;
+        } else if (k <= 0) {
+            return false;
+        }
+        p += k;
+        len -= k;
+    }
+    return true;
+}
+
+// halo rows go out as soon as they are ready
+inline void setNoDelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// the nodes start in any order, so connecting is retried for a while
+inline int connectTo(const ClusterNode &node) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    for (int attempt = 0; attempt < CLUSTER_CONNECT_TRIES; ++attempt) {
+        addrinfo *addrs = nullptr;
+        if (getaddrinfo(node.host.c_str(), node.port.c_str(), &hints, &addrs) == 0) {
+            for (addrinfo *a = addrs; a; a = a->ai_next) {
+                int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if (fd < 0) {
+                    continue;
+                }
+                if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+                    freeaddrinfo(addrs);
+                    setNoDelay(fd);
+                    return fd;
+                }
+                close(fd);
+            }
+            freeaddrinfo(addrs);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(CLUSTER_CONNECT_WAIT_MS));
+    }
+    std::cerr << "Error: unable to connect to " << node.host << ":" << node.port << std::endl;
+    return -1;
+}
+
+inline int listenOn(const std::string &port) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo *addrs = nullptr;
+    if (getaddrinfo(nullptr, port.c_str(), &hints, &addrs) != 0) {
+        std::cerr << "Error: bad port " << port << std::endl;
+        return -1;
+    }
+    int fd = socket(addrs->ai_family, addrs->ai_socktype, addrs->ai_protocol);
+    int one = 1;
+    if (fd >= 0) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if (fd < 0 || bind(fd, addrs->ai_addr, addrs->ai_addrlen) || listen(fd, 64)) {
+        std::cerr << "Error: unable to listen on port " << port << std::endl;
+        freeaddrinfo(addrs);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    freeaddrinfo(addrs);
+    return fd;
+}
+
+// one row each way on up to two links at once; both ends send before they
+// receive, so sending never blocks and takes what the socket buffers hold
+class HaloExchange {
+    struct Transfer {
+        int fd;
+        const char *out;
+        char *in;
+        size_t len, sent, received;
+    };
+    Transfer transfers[2];
+    size_t count = 0;
+
+    bool pump(bool wait) {
+        pollfd fds[2];
+        bool done = true;
+        for (size_t i = 0; i < count; ++i) {
+            Transfer &t = transfers[i];
+            fds[i] = {t.fd, (short)((t.sent < t.len ? POLLOUT : 0)
+                | (t.received < t.len ? POLLIN : 0)), 0};
+            done &= t.sent == t.len && t.received == t.len;
+        }
+        if (done) {
+            return true;
+        }
+        if (poll(fds, count, wait ? -1 : 0) < 0 && errno != EINTR) {
+            clusterLost();
+        }
+        for (size_t i = 0; i < count; ++i) {
+            Transfer &t = transfers[i];
+            // a closed link shows as a recv of 0 bytes
+            if (fds[i].revents & POLLERR) {
+                clusterLost();
+            }
+            if (fds[i].revents & POLLOUT) {
+                ssize_t k = send(t.fd, t.out + t.sent, t.len - t.sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (k < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    clusterLost();
+                }
+                t.sent += std::max<ssize_t>(k, 0);
+            }
+            if (fds[i].revents & POLLIN) {
+                ssize_t k = recv(t.fd, t.in + t.received, t.len - t.received, MSG_DONTWAIT);
+                if (k == 0 || (k < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    clusterLost();
+                }
+                t.received += std::max<ssize_t>(k, 0);
+            }
+        }
+        return false;
+    }
+
+public:
+    void add(int fd, const uint64_t *out, uint64_t *in, size_t words) {
+        transfers[count++] = {fd, (const char *)out, (char *)in, words * sizeof(uint64_t), 0, 0};
+    }
+
+    void start() {
+        pump(false);
+    }
+
+    void finish() {
+        while (!pump(true)) {}
+    }
+};
+
+// the connections of one node: halo links to the nodes of the strips above
+// and below, which form a ring, and links between the coordinator (rank 0)
+// and every other node
+class Cluster {
+    size_t node_rank = 0, node_count = 1;
+    int up = -1, down = -1;
+    // on the coordinator by rank, on the other nodes only [0]
+    std::vector<int> control;
+    std::mutex control_mutex, step_mutex;
+    std::atomic<uint32_t> next_id{0};
+
+    static bool hello(int fd, uint32_t kind, size_t rank, size_t count) {
+        ClusterHello h = {CLUSTER_MAGIC, kind, (uint32_t)rank, (uint32_t)count};
+        return sendAll(fd, &h, sizeof(h));
+    }
+
+public:
+    Cluster() = default;
+
+    ~Cluster() {
+        if (node_rank == 0) {
+            ClusterMessage quit = {CLUSTER_QUIT, 0, {}};
+            for (size_t r = 1; r < control.size(); ++r) {
+                sendAll(control[r], &quit, sizeof(quit));
+            }
+        }
+        for (int fd : control) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+        if (up >= 0) {
+            close(up);
+        }
+        if (down >= 0) {
+            close(down);
+        }
+    }
+
+    Cluster(const Cluster &) = delete;
+    Cluster &operator=(const Cluster &) = delete;
+
+    // listens first, then connects to the next node and the coordinator and
+    // accepts the links the others make to this node
+    bool connect(const std::vector<ClusterNode> &nodes, size_t rank) {
+        if (rank >= nodes.size()) {
+            std::cerr << "Error: rank " << rank << " is not one of the cluster nodes" << std::endl;
+            return false;
+        }
+        node_rank = rank;
+        node_count = nodes.size();
+        control.assign(rank == 0 ? node_count : 1, -1);
+        int listener = listenOn(nodes[rank].port);
+        if (listener < 0) {
+            return false;
+        }
+        bool ok = true;
+        if (node_count > 1) {
+            down = connectTo(nodes[(rank + 1) % node_count]);
+            ok &= down >= 0 && hello(down, 0, rank, node_count);
+        }
+        if (ok && rank > 0) {
+            control[0] = connectTo(nodes[0]);
+            ok &= control[0] >= 0 && hello(control[0], 1, rank, node_count);
+        }
+        size_t expected = (node_count > 1 ? 1 : 0) + (rank == 0 ? node_count - 1 : 0);
+        for (size_t i = 0; ok && i < expected; ++i) {
+            int fd = accept(listener, nullptr, nullptr);
+            ClusterHello h;
+            if (fd < 0 || !recvAll(fd, &h, sizeof(h)) || h.magic != CLUSTER_MAGIC
+                    || h.nodes != node_count || h.rank >= node_count) {
+                std::cerr << "Error: bad connection from a cluster node" << std::endl;
+                ok = false;
+                break;
+            }
+            setNoDelay(fd);
+            if (h.kind == 0) {
+                up = fd;
+            } else {
+                control[h.rank] = fd;
+            }
+        }
+        close(listener);
+        return ok;
+    }
+
+    size_t rank() const {
+        return node_rank;
+    }
+
+    size_t size() const {
+        return node_count;
+    }
+
+    int upLink() const {
+        return up;
+    }
+
+    int downLink() const {
+        return down;
+    }
+
+    uint32_t newId() {
+        return next_id++;
+    }
+
+    // held over a request and its reply, so engines on other threads (a
+    // save of a copy) do not mix up replies
+    std::mutex &controlMutex() {
+        return control_mutex;
+    }
+
+    // steps of different boards would mix their halos
+    std::mutex &stepMutex() {
+        return step_mutex;
+    }
+
+    // to node from the coordinator, to the coordinator from the others
+    void send(size_t node, const ClusterMessage &message, const void *payload = nullptr,
+            size_t len = 0)
+    {
+        int fd = control[node_rank == 0 ? node : 0];
+        if (!sendAll(fd, &message, sizeof(message)) || (len && !sendAll(fd, payload, len))) {
+            clusterLost();
+        }
+    }
+
+    void receive(size_t node, void *data, size_t len) {
+        if (!recvAll(control[node_rank == 0 ? node : 0], data, len)) {
+            clusterLost();
+        }
+    }
+};
+
+// rows [begin, end) of the board are kept by node rank
+inline void clusterRows(size_t n, size_t rank, size_t nodes, size_t &begin, size_t &end) {
+    begin = n * rank / nodes;
+    end = n * (rank + 1) / nodes;
+}
+
+// the rows of one node, laid out like swar with a halo row above and below
+// them; the halo rows come from the neighbouring nodes
+class ClusterStrip {
+    size_t n, words, y0, rows;
+    uint64_t last_mask;
+    Rule life_rule;
+    Topology edges;
+    LifeRowFn life_row;
+    ThreadPool *pool;
+    // rows + 2 rows, row 1 is board row y0
+    PageVector<uint64_t> cells, next;
+    TrackedHash board_hash;
+
+    uint64_t *row(size_t r) {
+        return &cells[r * words];
+    }
+
+    const uint64_t *row(size_t r) const {
+        return &cells[r * words];
+    }
+
+    uint64_t stepRow(size_t r) {
+        const uint64_t *a = row(r - 1), *b = row(r), *c = row(r + 1);
+        uint64_t *out = &next[r * words];
+        life_row(a, b, c, out, words, life_rule);
+        if (edges == Topology::Torus) {
+            lifeRowWrap(a, b, c, out, words, n, life_rule);
+        }
+        out[words - 1] &= last_mask;
+        uint64_t keys = 0;
+        if (board_hash.tracking()) {
+            for (size_t i = 0; i < words; ++i) {
+                keys ^= zobristWord(b[i] ^ out[i], i * 64, y0 + r - 1);
+            }
+        }
+        return keys;
+    }
+
+public:
+    ClusterStrip(size_t size, size_t rank, size_t nodes, const EngineOptions &options) :
+        n(size), life_rule(options.rule), edges(options.topology),
+        life_row(lifeRowFn(options.rule)), pool(options.pool)
+    {
+        size_t end;
+        clusterRows(size, rank, nodes, y0, end);
+        rows = end - y0;
+        words = (size + 63) / 64;
+        last_mask = size % 64 ? (1ull << (size % 64)) - 1 : ~0ull;
+        cells.assign((rows + 2) * words, 0);
+        next.assign((rows + 2) * words, 0);
+    }
+
+    bool owns(int64_t y) const {
+        return y >= (int64_t)y0 && y < (int64_t)(y0 + rows);
+    }
+
+    void clear() {
+        std::fill(cells.begin(), cells.end(), 0);
+        board_hash.invalidate();
+    }
+
+    void populateRandom(const SoupOptions &soup) {
+        for (size_t r = 0; r < rows; ++r) {
+            for (size_t i = 0; i < words; ++i) {
+                row(r + 1)[i] = soupWord(soup, y0 + r, i, n);
+            }
+        }
+        board_hash.invalidate();
+    }
+
+    void toggle(int64_t x, int64_t y) {
+        row(y - y0 + 1)[x >> 6] ^= 1ull << (x & 63);
+        board_hash.flip(zobristKey(x, y));
+    }
+
+    void setAlive(const uint32_t *idxs, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            uint16_t x, y;
+            deinterleaveXY(idxs[i], x, y);
+            if (x < n && owns(y)) {
+                row(y - y0 + 1)[x >> 6] |= 1ull << (x & 63);
+            }
+        }
+        board_hash.invalidate();
+    }
+
+    // only the part of the board Z-curve indices reach
+    void getAlive(std::vector<uint32_t> &idxs) const {
+        for (size_t r = 0; r < rows && y0 + r < 65536; ++r) {
+            for (size_t i = 0; i < words && i < 1024; ++i) {
+                uint64_t w = row(r + 1)[i];
+                while (w) {
+                    idxs.push_back(interleaveXY((i << 6) + __builtin_ctzll(w), y0 + r));
+                    w &= w - 1;
+                }
+            }
+        }
+    }
+
+    uint64_t population() const {
+        uint64_t count = 0;
+        for (size_t i = words; i < (rows + 1) * words; ++i) {
+            count += __builtin_popcountll(cells[i]);
+        }
+        return count;
+    }
+
+    uint64_t hash() const {
+        return board_hash.get([&] {
+            uint64_t h = 0;
+            for (size_t r = 0; r < rows; ++r) {
+                for (size_t i = 0; i < words; ++i) {
+                    h ^= zobristWord(row(r + 1)[i], i * 64, y0 + r);
+                }
+            }
+            return h;
+        });
+    }
+
+    // rows of the region outside the strip are left alone
+    void readRegion(int64_t x0, int64_t ry0, size_t w, size_t h, uint64_t *bits,
+            size_t stride) const
+    {
+        for (size_t dy = 0; dy < h; ++dy) {
+            int64_t y = ry0 + dy;
+            if (!owns(y)) {
+                continue;
+            }
+            const uint64_t *cur = row(y - y0 + 1);
+            for (size_t j = 0; j < stride && j * 64 < w; ++j) {
+                int64_t x = x0 + (int64_t)j * 64;
+                int64_t i = x >> 6, shift = x & 63;
+                uint64_t lo = i >= 0 && i < (int64_t)words ? cur[i] : 0;
+                uint64_t hi = i + 1 >= 0 && i + 1 < (int64_t)words ? cur[i + 1] : 0;
+                uint64_t w64 = shift ? (lo >> shift) | (hi << (64 - shift)) : lo;
+                size_t left = w - j * 64;
+                if (left < 64) {
+                    w64 &= (1ull << left) - 1;
+                }
+                bits[dy * stride + j] = w64;
+            }
+        }
+    }
+
+    void writeRegion(int64_t x0, int64_t ry0, size_t w, size_t h, const uint64_t *bits,
+            size_t stride)
+    {
+        board_hash.invalidate();
+        for (size_t dy = 0; dy < h; ++dy) {
+            int64_t y = ry0 + dy;
+            if (!owns(y)) {
+                continue;
+            }
+            uint64_t *cur = row(y - y0 + 1);
+            for (size_t dx = 0; dx < w; ++dx) {
+                int64_t x = x0 + dx;
+                if (x < 0 || x >= (int64_t)n) {
+                    continue;
+                }
+                uint64_t bit = 1ull << (x & 63);
+                if ((bits[dy * stride + (dx >> 6)] >> (dx & 63)) & 1) {
+                    cur[x >> 6] |= bit;
+                } else {
+                    cur[x >> 6] &= ~bit;
+                }
+            }
+        }
+    }
+
+    // counts of the rows of the strip only, the coordinator adds them up
+    void readDensity(int64_t x0, int64_t by0, size_t w, size_t h, unsigned level,
+            uint32_t *counts) const
+    {
+        int64_t cx0 = std::max<int64_t>(x0 * (1ll << level), 0);
+        int64_t cx1 = std::min<int64_t>((x0 + (int64_t)w) * (1ll << level), n);
+        int64_t cy0 = std::max<int64_t>(by0 * (1ll << level), y0);
+        int64_t cy1 = std::min<int64_t>((by0 + (int64_t)h) * (1ll << level), y0 + rows);
+        for (int64_t y = cy0; y < cy1; ++y) {
+            const uint64_t *cur = row(y - y0 + 1);
+            uint32_t *out = counts + ((y >> level) - by0) * w;
+            for (int64_t i = cx0 >> 6; i < (cx1 + 63) >> 6; ++i) {
+                uint64_t word = cur[i];
+                while (word) {
+                    int64_t x = i * 64 + __builtin_ctzll(word);
+                    word &= word - 1;
+                    if (x >= cx0 && x < cx1) {
+                        ++out[(x >> level) - x0];
+                    }
+                }
+            }
+        }
+    }
+
+    // the edge rows are sent off first and the rows that only need the strip
+    // computed while they travel, the two edge rows once the halos arrived
+    void step(Cluster &cluster) {
+        HaloExchange halo;
+        bool torus = edges == Topology::Torus;
+        size_t rank = cluster.rank(), nodes = cluster.size();
+        if (nodes == 1 && torus) {
+            std::memcpy(row(0), row(rows), words * sizeof(uint64_t));
+            std::memcpy(row(rows + 1), row(1), words * sizeof(uint64_t));
+        } else {
+            if (rank > 0 || torus) {
+                halo.add(cluster.upLink(), row(1), row(0), words);
+            } else {
+                std::fill(row(0), row(0) + words, 0);
+            }
+            if (rank + 1 < nodes || torus) {
+                halo.add(cluster.downLink(), row(rows), row(rows + 1), words);
+            } else {
+                std::fill(row(rows + 1), row(rows + 1) + words, 0);
+            }
+        }
+        halo.start();
+        std::atomic<uint64_t> keys{0};
+        if (rows > 2) {
+            size_t interior = rows - 2;
+            size_t parts = pool ? std::min(interior, pool->size() * 4) : 1;
+            auto part = [&](size_t p) {
+                uint64_t k = 0;
+                for (size_t r = 2 + interior * p / parts; r < 2 + interior * (p + 1) / parts; ++r) {
+                    k ^= stepRow(r);
+                }
+                keys.fetch_xor(k, std::memory_order_relaxed);
+            };
+            if (parts > 1) {
+                pool->parallelFor(parts, part);
+            } else {
+                part(0);
+            }
+        }
+        halo.finish();
+        uint64_t edge_keys = stepRow(1);
+        if (rows > 1) {
+            edge_keys ^= stepRow(rows);
+        }
+        std::swap(cells, next);
+        board_hash.flip(keys ^ edge_keys);
+    }
+};
+
+// serves the boards of the coordinator until it sends CLUSTER_QUIT
+inline int runClusterNode(Cluster &cluster, const EngineOptions &options) {
+    std::map<uint32_t, std::unique_ptr<ClusterStrip>> strips;
+    std::vector<uint64_t> bits;
+    std::vector<uint32_t> idxs, counts;
+    for (;;) {
+        ClusterMessage m;
+        cluster.receive(0, &m, sizeof(m));
+        if (m.op == CLUSTER_QUIT) {
+            return 0;
+        } else if (m.op == CLUSTER_CREATE) {
+            EngineOptions strip_options = options;
+            strip_options.rule = {(uint16_t)m.args[1], (uint16_t)m.args[2]};
+            strip_options.topology = (Topology)m.args[3];
+            strips[m.id] = std::make_unique<ClusterStrip>(m.args[0], cluster.rank(),
+                cluster.size(), strip_options);
+            continue;
+        } else if (m.op == CLUSTER_DROP) {
+            strips.erase(m.id);
+            continue;
+        } else if (m.op == CLUSTER_CLONE) {
+            strips[m.args[0]] = std::make_unique<ClusterStrip>(*strips.at(m.id));
+            continue;
+        }
+        ClusterStrip &strip = *strips.at(m.id);
+        switch (m.op) {
+            case CLUSTER_CLEAR:
+                strip.clear();
+                break;
+            case CLUSTER_POPULATE: {
+                SoupOptions soup;
+                soup.seed = m.args[0];
+                std::memcpy(&soup.density, &m.args[1], sizeof(double));
+                strip.populateRandom(soup);
+                break;
+            }
+            case CLUSTER_TOGGLE:
+                strip.toggle(m.args[0], m.args[1]);
+                break;
+            case CLUSTER_SET_ALIVE:
+                idxs.resize(m.args[0]);
+                cluster.receive(0, idxs.data(), idxs.size() * sizeof(uint32_t));
+                strip.setAlive(idxs.data(), idxs.size());
+                break;
+            case CLUSTER_GET_ALIVE: {
+                idxs.clear();
+                strip.getAlive(idxs);
+                uint64_t len = idxs.size();
+                m.args[0] = len;
+                cluster.send(0, m, idxs.data(), len * sizeof(uint32_t));
+                break;
+            }
+            case CLUSTER_POPULATION:
+                m.args[0] = strip.population();
+                cluster.send(0, m);
+                break;
+            case CLUSTER_HASH:
+                m.args[0] = strip.hash();
+                cluster.send(0, m);
+                break;
+            case CLUSTER_READ: {
+                size_t stride = (m.args[2] + 63) / 64;
+                bits.assign(stride * m.args[3], 0);
+                strip.readRegion(m.args[0], m.args[1], m.args[2], m.args[3], bits.data(), stride);
+                cluster.send(0, m, bits.data(), bits.size() * sizeof(uint64_t));
+                break;
+            }
+            case CLUSTER_WRITE: {
+                size_t stride = (m.args[2] + 63) / 64;
+                bits.resize(stride * m.args[3]);
+                cluster.receive(0, bits.data(), bits.size() * sizeof(uint64_t));
+                strip.writeRegion(m.args[0], m.args[1], m.args[2], m.args[3], bits.data(), stride);
+                break;
+            }
+            case CLUSTER_DENSITY:
+                counts.assign(m.args[2] * m.args[3], 0);
+                strip.readDensity(m.args[0], m.args[1], m.args[2], m.args[3], m.args[4],
+                    counts.data());
+                cluster.send(0, m, counts.data(), counts.size() * sizeof(uint32_t));
+                break;
+            case CLUSTER_STEP:
+                strip.step(cluster);
+                break;
+        }
+    }
+}
+
+// the engine on the coordinator: its own strip is stepped here, the others
+// on their nodes, and reads gather the rows they cover from the nodes that
+// keep them; replies come back in the order the requests went out
+class ClusterField : public Engine {
+    Cluster &cluster;
+    uint32_t id;
+    size_t n;
+    Rule life_rule;
+    Topology edges;
+    std::unique_ptr<ClusterStrip> local;
+
+    ClusterField(Cluster &cluster, uint32_t id, size_t n, Rule rule, Topology edges,
+            std::unique_ptr<ClusterStrip> local) :
+        cluster(cluster), id(id), n(n), life_rule(rule), edges(edges), local(std::move(local)) {}
+
+    ClusterMessage message(ClusterOp op, std::initializer_list<int64_t> args = {}) const {
+        ClusterMessage m = {(uint32_t)op, id, {}};
+        std::copy(args.begin(), args.end(), m.args);
+        return m;
+    }
+
+    void broadcast(const ClusterMessage &m) const {
+        for (size_t r = 1; r < cluster.size(); ++r) {
+            cluster.send(r, m);
+        }
+    }
+
+    // the nodes keeping any of rows [y0, y0 + h)
+    template <typename F>
+    void forNodes(int64_t y0, size_t h, F &&fn) const {
+        for (size_t r = 0; r < cluster.size(); ++r) {
+            size_t begin, end;
+            clusterRows(n, r, cluster.size(), begin, end);
+            int64_t a = std::max<int64_t>(y0, begin), b = std::min<int64_t>(y0 + h, end);
+            if (a < b) {
+                fn(r, a, b - a);
+            }
+        }
+    }
+
+    size_t owner(int64_t y) const {
+        size_t node = 0;
+        forNodes(y, 1, [&](size_t r, int64_t, size_t) { node = r; });
+        return node;
+    }
+
+    // the sum of a count or the xor of a hash over the nodes
+    uint64_t gather(ClusterOp op, uint64_t mine, bool xor_values) const {
+        std::lock_guard<std::mutex> lock(cluster.controlMutex());
+        broadcast(message(op));
+        for (size_t r = 1; r < cluster.size(); ++r) {
+            ClusterMessage reply;
+            cluster.receive(r, &reply, sizeof(reply));
+            mine = xor_values ? mine ^ reply.args[0] : mine + reply.args[0];
+        }
+        return mine;
+    }
+
+public:
+    ClusterField(size_t size, const EngineOptions &options) :
+        cluster(options.cluster ? *options.cluster : throw std::invalid_argument(
+            "the cluster engine needs --cluster")),
+        id(cluster.newId()), n(size), life_rule(options.rule), edges(options.topology)
+    {
+        checkRule(options.rule);
+        if (size == 0 || (size & (size - 1))) {
+            throw std::invalid_argument("size needs to be power of 2");
+        }
+        if (size > CLUSTER_SIZE_MAX || size < cluster.size()) {
+            throw std::invalid_argument("size needs to be in [nodes, 2^20]");
+        }
+        local = std::make_unique<ClusterStrip>(size, 0, cluster.size(), options);
+        std::lock_guard<std::mutex> lock(cluster.controlMutex());
+        broadcast(message(CLUSTER_CREATE, {(int64_t)size, options.rule.birth,
+            options.rule.survive, (int64_t)options.topology}));
+    }
+
+    ~ClusterField() {
+        std::lock_guard<std::mutex> lock(cluster.controlMutex());
+        broadcast(message(CLUSTER_DROP));
+    }
+
+    size_t size() const override {
+        return n;
+    }
+
+    Rule rule() const override {
+        return life_rule;
+    }
+
+    Topology topology() const override {
+        return edges;
+    }
+
+    bool get(int64_t x, int64_t y) const override {
+        uint64_t bit = 0;
+        readRegion(x, y, 1, 1, &bit, 1);
+        return bit;
+    }
+
+    void toggle(int64_t x, int64_t y) override {
+        size_t node = owner(y);
+        if (node == 0) {
+            local->toggle(x, y);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(cluster.controlMutex());
+        cluster.send(node, message(CLUSTER_TOGGLE, {x, y}));
+    }
+
+    void clear() override {
+        {
+            std::lock_guard<std::mutex> lock(cluster.controlMutex());
+            broadcast(message(CLUSTER_CLEAR));
+        }
+        local->clear();
+    }
+
+    // every node fills its own rows, the words only depend on the row
+    void populateRandom(const SoupOptions &soup) override {
+        int64_t density;
+        std::memcpy(&density, &soup.density, sizeof(double));
+        {
+            std::lock_guard<std::mutex> lock(cluster.controlMutex());
+            broadcast(message(CLUSTER_POPULATE, {(int64_t)soup.seed, density}));
+        }
+        local->populateRandom(soup);
+    }
+
+    void setAlive(const uint32_t *idxs, size_t len) override {
+        std::vector<std::vector<uint32_t>> parts(cluster.size());
+        for (size_t i = 0; i < len; ++i) {
+            uint16_t x, y;
+            deinterleaveXY(idxs[i], x, y);
+            parts[y < n ? owner(y) : 0].push_back(idxs[i]);
+        }
+        {
+            std::lock_guard<std::mutex> lock(cluster.controlMutex());
+            for (size_t r = 1; r < cluster.size(); ++r) {
+                cluster.send(r, message(CLUSTER_SET_ALIVE, {(int64_t)parts[r].size()}),
+                    parts[r].data(), parts[r].size() * sizeof(uint32_t));
+            }
+        }
+        local->setAlive(parts[0].data(), parts[0].size());
+    }
+
+    void getAlive(std::vector<uint32_t> &idxs) const override {
+        size_t first = idxs.size();
+        std::lock_guard<std::mutex> lock(cluster.controlMutex());
+        broadcast(message(CLUSTER_GET_ALIVE));
+        local->getAlive(idxs);
+        for (size_t r = 1; r < cluster.size(); ++r) {
+            ClusterMessage reply;
+            cluster.receive(r, &reply, sizeof(reply));
+            size_t at = idxs.size();
+            idxs.resize(at + reply.args[0]);
+            cluster.receive(r, idxs.data() + at, reply.args[0] * sizeof(uint32_t));
+        }
+        std::sort(idxs.begin() + first, idxs.end());
+    }
+
+    uint64_t population() const override {
+        return gather(CLUSTER_POPULATION, local->population(), false);
+    }
+
+    uint64_t hash() const override {
+        return gather(CLUSTER_HASH, local->hash(), true);
+    }
+
+    std::unique_ptr<Engine> clone() const override {
+        uint32_t copy_id = cluster.newId();
+        {
+            std::lock_guard<std::mutex> lock(cluster.controlMutex());
+            broadcast(message(CLUSTER_CLONE, {copy_id}));
+        }
+        return std::unique_ptr<Engine>(new ClusterField(cluster, copy_id, n, life_rule, edges,
+            std::make_unique<ClusterStrip>(*local)));
+    }
+
+    // all requests go out before the first reply is read, so the nodes copy
+    // their rows at the same time
+    void readRegion(int64_t x0, int64_t y0, size_t w, size_t h,
+            uint64_t *bits, size_t stride) const override
+    {
+        size_t words = (w + 63) / 64;
+        std::lock_guard<std::mutex> lock(cluster.controlMutex());
+        forNodes(y0, h, [&](size_t r, int64_t y, size_t rows) {
+            if (r) {
+                cluster.send(r, message(CLUSTER_READ, {x0, y, (int64_t)w, (int64_t)rows}));
+            }
+        });
+        local->readRegion(x0, y0, w, h, bits, stride);
+        std::vector<uint64_t> part;
+        forNodes(y0, h, [&](size_t r, int64_t y, size_t rows) {
+            if (!r) {
+                return;
+            }
+            ClusterMessage reply;
+            cluster.receive(r, &reply, sizeof(reply));
+            part.resize(words * rows);
+            cluster.receive(r, part.data(), part.size() * sizeof(uint64_t));
+            for (size_t dy = 0; dy < rows; ++dy) {
+                std::memcpy(&bits[(y - y0 + dy) * stride], &part[dy * words],
+                    words * sizeof(uint64_t));
+            }
+        });
+    }
+
+    // a region is split by rows, a .gol tile mostly goes to one node
+    void writeRegion(int64_t x0, int64_t y0, size_t w, size_t h,
+            const uint64_t *bits, size_t stride) override
+    {
+        size_t words = (w + 63) / 64;
+        std::vector<uint64_t> part;
+        std::lock_guard<std::mutex> lock(cluster.controlMutex());
+        forNodes(y0, h, [&](size_t r, int64_t y, size_t rows) {
+            if (!r) {
+                local->writeRegion(x0, y0, w, h, bits, stride);
+                return;
+            }
+            part.resize(words * rows);
+            for (size_t dy = 0; dy < rows; ++dy) {
+                std::memcpy(&part[dy * words], &bits[(y - y0 + dy) * stride],
+                    words * sizeof(uint64_t));
+            }
+            cluster.send(r, message(CLUSTER_WRITE, {x0, y, (int64_t)w, (int64_t)rows}),
+                part.data(), part.size() * sizeof(uint64_t));
+        });
+    }
+
+    // every node counts the blocks of its rows, blocks across two strips
+    // get counts from both
+    void readDensity(int64_t x0, int64_t y0, size_t w, size_t h, unsigned level,
+            uint32_t *counts) const override
+    {
+        std::lock_guard<std::mutex> lock(cluster.controlMutex());
+        std::vector<size_t> asked;
+        forNodes(y0 * (1ll << level), h << level, [&](size_t r, int64_t, size_t) {
+            if (r) {
+                cluster.send(r, message(CLUSTER_DENSITY, {x0, y0, (int64_t)w, (int64_t)h, level}));
+                asked.push_back(r);
+            }
+        });
+        local->readDensity(x0, y0, w, h, level, counts);
+        std::vector<uint32_t> part(w * h);
+        for (size_t r : asked) {
+            ClusterMessage reply;
+            cluster.receive(r, &reply, sizeof(reply));
+            cluster.receive(r, part.data(), part.size() * sizeof(uint32_t));
+            for (size_t j = 0; j < part.size(); ++j) {
+                counts[j] += part[j];
+            }
+        }
+    }
+
+    // the nodes step their strips on their own, they only wait on halos
+    void step() override {
+        std::lock_guard<std::mutex> step_lock(cluster.stepMutex());
+        {
+            std::lock_guard<std::mutex> lock(cluster.controlMutex());
+            broadcast(message(CLUSTER_STEP));
+        }
+        local->step(cluster);
+    }
+};
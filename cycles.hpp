@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "engine.hpp"
+
+// periods up to this many steps are found
+#define CYCLE_HISTORY 64
+
+// remembers the hashes of the last CYCLE_HISTORY steps, a board that hashes
+// like one of them has entered a cycle (a still life has period 1)
+class CycleDetector {
+    struct Entry {
+        uint64_t hash;
+        uint64_t population;
+        uint64_t generation;
+    };
+    std::vector<Entry> history;
+    size_t next = 0;
+    uint64_t cycle_period = 0;
+    uint64_t cycle_start = 0;
+    bool stop_on_cycle;
+
+public:
+    CycleDetector(bool stop_on_cycle = false) : stop_on_cycle(stop_on_cycle) {}
+
+    // an edited or loaded board starts a new history
+    void reset() {
+        history.clear();
+        next = 0;
+        cycle_period = 0;
+    }
+
+    // true when the board is in a cycle as of this generation
+    bool update(const Engine &field, uint64_t generation) {
+        Entry entry = {field.hash(), field.population(), generation};
+        cycle_period = 0;
+        for (const Entry &old : history) {
+            if (old.hash == entry.hash && old.population == entry.population
+                    && old.generation < generation
+                    && (!cycle_period || generation - old.generation < cycle_period)) {
+                cycle_period = generation - old.generation;
+                cycle_start = old.generation;
+            }
+        }
+        if (history.size() < CYCLE_HISTORY) {
+            history.push_back(entry);
+        } else {
+            history[next] = entry;
+            next = (next + 1) % CYCLE_HISTORY;
+        }
+        return cycle_period;
+    }
+
+    // in generations, 0 while no cycle is found
+    uint64_t period() const {
+        return cycle_period;
+    }
+
+    // the earlier generation the board repeats
+    uint64_t start() const {
+        return cycle_start;
+    }
+
+    // a batch run has nothing left to find once the board cycles
+    bool shouldStop() const {
+        return stop_on_cycle && cycle_period;
+    }
+};
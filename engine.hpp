@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "rule.hpp"
+#include "soup.hpp"
+#include "zobrist.hpp"
+
+class ThreadPool;
+class Cluster;
+
+// what lies past the edges of a bounded board
+enum class Topology {
+    // cells off the board are dead
+    Dead,
+    // the board wraps around in x and y
+    Torus,
+};
+
+struct EngineOptions {
+    // steps tiles in parallel when set
+    ThreadPool *pool = nullptr;
+    // zcurve: read one buffer and write the other instead of marking cells
+    bool double_buffer = false;
+    // hashlife: every step advances 2^step_exp generations
+    unsigned step_exp = 0;
+    // swar: every step advances this many generations per pass over the board
+    unsigned time_block = 1;
+    // B0 rules are not supported, the empty board would not stay empty
+    Rule rule = LIFE_RULE;
+    Topology topology = Topology::Dead;
+    // cluster: the connections to the other nodes
+    Cluster *cluster = nullptr;
+};
+
+// throws for the rules EngineOptions::rule can't take
+inline void checkRule(const Rule &rule) {
+    if (rule.birth & 1) {
+        throw std::invalid_argument("rules with B0 are not supported");
+    }
+}
+
+// common interface of the simulation engines, coordinates are (x, y) cells
+class Engine {
+public:
+    virtual ~Engine() = default;
+
+    virtual size_t size() const = 0;
+    // unbounded engines take any coordinates, bounded ones [0, size)
+    virtual bool bounded() const {
+        return true;
+    }
+    virtual bool get(int64_t x, int64_t y) const = 0;
+    virtual void toggle(int64_t x, int64_t y) = 0;
+    virtual void clear() = 0;
+    // the same cells for a soup on every engine, see soupWord
+    virtual void populateRandom(const SoupOptions &soup) = 0;
+    // Z-curve indices, the representation used by .gol files
+    virtual void setAlive(const uint32_t *idxs, size_t len) = 0;
+    virtual void getAlive(std::vector<uint32_t> &idxs) const = 0;
+    virtual uint64_t population() const = 0;
+    virtual void step() = 0;
+    // independent copy of the cells for reading on another thread, it does
+    // not step in parallel
+    virtual std::unique_ptr<Engine> clone() const = 0;
+
+    virtual Rule rule() const = 0;
+    // unbounded engines have no edges and report Dead
+    virtual Topology topology() const {
+        return Topology::Dead;
+    }
+
+    virtual uint64_t generationsPerStep() const {
+        return 1;
+    }
+
+    // cells the last step computed, engines that skip work report less
+    virtual uint64_t cellsVisited() const {
+        return size() * size();
+    }
+
+    // w x h cells from (x0, y0) into rows of stride words, bit (x - x0) % 64
+    // of word (x - x0) / 64, bits has to be zeroed
+    virtual void readRegion(int64_t x0, int64_t y0, size_t w, size_t h,
+            uint64_t *bits, size_t stride) const
+    {
+        int64_t n = size();
+        for (size_t dy = 0; dy < h; ++dy) {
+            int64_t y = y0 + dy;
+            if (bounded() && (y < 0 || y >= n)) {
+                continue;
+            }
+            for (size_t dx = 0; dx < w; ++dx) {
+                int64_t x = x0 + dx;
+                if (bounded() && (x < 0 || x >= n)) {
+                    continue;
+                }
+                if (get(x, y)) {
+                    bits[dy * stride + (dx >> 6)] |= 1ull << (dx & 63);
+                }
+            }
+        }
+    }
+
+    // replaces w x h cells from (x0, y0) by bits laid out like readRegion,
+    // cells off a bounded board are ignored
+    virtual void writeRegion(int64_t x0, int64_t y0, size_t w, size_t h,
+            const uint64_t *bits, size_t stride)
+    {
+        int64_t n = size();
+        for (size_t dy = 0; dy < h; ++dy) {
+            int64_t y = y0 + dy;
+            if (bounded() && (y < 0 || y >= n)) {
+                continue;
+            }
+            for (size_t dx = 0; dx < w; ++dx) {
+                int64_t x = x0 + dx;
+                if (bounded() && (x < 0 || x >= n)) {
+                    continue;
+                }
+                if (get(x, y) != (bool)((bits[dy * stride + (dx >> 6)] >> (dx & 63)) & 1)) {
+                    toggle(x, y);
+                }
+            }
+        }
+    }
+
+    // alive cells per 2^level x 2^level block for w x h blocks from block
+    // (x0, y0) into rows of w counts, counts has to be zeroed
+    virtual void readDensity(int64_t x0, int64_t y0, size_t w, size_t h, unsigned level,
+            uint32_t *counts) const
+    {
+        int64_t n = size();
+        int64_t cx0 = x0 * (1ll << level), cx1 = (x0 + (int64_t)w) * (1ll << level);
+        int64_t cy0 = y0 * (1ll << level), cy1 = (y0 + (int64_t)h) * (1ll << level);
+        if (bounded()) {
+            cx0 = std::max<int64_t>(cx0, 0);
+            cy0 = std::max<int64_t>(cy0, 0);
+            cx1 = std::min(cx1, n);
+            cy1 = std::min(cy1, n);
+        }
+        if (cx0 >= cx1) {
+            return;
+        }
+        // one row of cells at a time
+        size_t len = cx1 - cx0, stride = (len + 63) / 64;
+        std::vector<uint64_t> row(stride);
+        for (int64_t y = cy0; y < cy1; ++y) {
+            std::fill(row.begin(), row.end(), 0);
+            readRegion(cx0, y, len, 1, row.data(), stride);
+            uint32_t *out = counts + ((y >> level) - y0) * w;
+            for (size_t i = 0; i < stride; ++i) {
+                uint64_t word = row[i];
+                while (word) {
+                    int64_t x = cx0 + (int64_t)(i * 64) + __builtin_ctzll(word);
+                    ++out[(x >> level) - x0];
+                    word &= word - 1;
+                }
+            }
+        }
+    }
+
+    // Zobrist hash of the live cells on the board, of every live cell when
+    // unbounded, equal boards hash the same in every engine; engines with a
+    // TrackedHash keep it up to date while stepping, the default reads the
+    // whole board
+    virtual uint64_t hash() const {
+        int64_t n = size();
+        size_t stride = (n + 63) / 64;
+        std::vector<uint64_t> row(stride);
+        uint64_t h = 0;
+        for (int64_t y = 0; y < n; ++y) {
+            std::fill(row.begin(), row.end(), 0);
+            readRegion(0, y, n, 1, row.data(), stride);
+            for (size_t i = 0; i < stride; ++i) {
+                h ^= zobristWord(row[i], i * 64, y);
+            }
+        }
+        return h;
+    }
+};
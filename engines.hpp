@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "engine.hpp"
+#include "gamefield.hpp"
+#include "bitfield.hpp"
+#include "cluster.hpp"
+#include "gpu.hpp"
+#include "hashlife.hpp"
+#include "livelist.hpp"
+#include "lut.hpp"
+#include "sparse.hpp"
+
+#define ENGINE_NAMES "zcurve|swar|lut|list|hashlife|sparse|gpu|cluster"
+
+inline std::unique_ptr<Engine> makeEngine(const std::string &name, size_t size,
+        const EngineOptions &options)
+{
+    if (name == "zcurve") {
+        return std::make_unique<ZCurveEngine>(size, options);
+    } else if (name == "swar") {
+        return std::make_unique<BitField>(size, options);
+    } else if (name == "lut") {
+        return std::make_unique<LutField>(size, options);
+    } else if (name == "list") {
+        return std::make_unique<LiveListField>(size, options);
+    } else if (name == "hashlife") {
+        return std::make_unique<HashLife>(size, options);
+    } else if (name == "sparse") {
+        return std::make_unique<SparseField>(size, options);
+    } else if (name == "gpu") {
+        return std::make_unique<GpuField>(size, options);
+    } else if (name == "cluster") {
+        return std::make_unique<ClusterField>(size, options);
+    }
+    throw std::invalid_argument("unknown engine " + name);
+}
@@ -0,0 +1,666 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "engine.hpp"
+#include "pages.hpp"
+#include "threadpool.hpp"
+
+inline uint32_t delta_swap(uint32_t a, uint32_t mask, uint8_t shift) {
+    uint32_t b = ((a << shift) ^ a) & mask;
+    a ^= b ^ (b >> shift);
+    return a;
+}
+
+inline uint32_t interleaveXY(uint16_t x, uint16_t y) {
+    uint32_t res = (y << 16) | x;
+    res = delta_swap(res, 0b00000000111111110000000000000000, 8);
+    res = delta_swap(res, 0b00001111000000000000111100000000, 4);
+    res = delta_swap(res, 0b00110000001100000011000000110000, 2);
+    res = delta_swap(res, 0b01000100010001000100010001000100, 1);
+    return res;
+}
+
+inline void deinterleaveXY(uint32_t idx, uint16_t &x, uint16_t &y) {
+    idx = delta_swap(idx, 0b01000100010001000100010001000100, 1);
+    idx = delta_swap(idx, 0b00110000001100000011000000110000, 2);
+    idx = delta_swap(idx, 0b00001111000000000000111100000000, 4);
+    idx = delta_swap(idx, 0b00000000111111110000000000000000, 8);
+    x = idx & 0xffff;
+    y = idx >> 16;
+}
+
+enum Cell : uint8_t {
+    Dead = 0,
+    Alive = 1,
+    Dying = 3,
+    Birthing = 2,
+    DeadVisited = 4,
+};
+
+// Z-curve
+class GameField {
+    static const uint32_t MASK_X = 0b01010101010101010101010101010101;
+    static const uint32_t MASK_Y = 0b10101010101010101010101010101010;
+
+    uint8_t n;
+    size_t size_x;
+    size_t size_y;
+    // neighbour coordinates are masked by these, on a torus they wrap
+    uint32_t wrap_x = MASK_X;
+    uint32_t wrap_y = MASK_Y;
+public:
+    PageVector<Cell> cells;
+    size_t size;
+    size_t idx;
+    Rule rule = LIFE_RULE;
+
+    GameField(size_t size) : size(size), idx(0) {
+        const uint8_t bits = sizeof(size) * 8;
+        uint8_t n;
+        for (n = 0; n < bits; (size >>= 1, ++n)) {
+            if (size & 1) {
+                size >>= 1;
+                break;
+            }
+        }
+        if (n == bits || size) {
+            throw std::invalid_argument("size needs to be power of 2");
+        }
+        if (n > 12) {
+            throw std::invalid_argument("size >4096 not supported");
+        }
+        this->n = n;
+        cells.assign(1 << (n << 1), Dead);
+        size_x = interleaveXY(this->size, 0);
+        size_y = size_x << 1;
+    }
+
+    // on a torus no neighbour is ever off the field
+    void setTopology(Topology topology) {
+        if (topology == Topology::Torus) {
+            wrap_x = (size_x - 1) & MASK_X;
+            wrap_y = (size_y - 1) & MASK_Y;
+        } else {
+            wrap_x = MASK_X;
+            wrap_y = MASK_Y;
+        }
+    }
+
+    void clear() {
+        std::fill(cells.begin(), cells.end(), Dead);
+    }
+
+    Cell setCursor(size_t x, size_t y) {
+        if (x >= size || y >= size) {
+            return DeadVisited;
+        }
+        idx = interleaveXY(x, y);
+        return cells[idx];
+    }
+
+    void toggle() {
+        cells[idx] = cells[idx] == Dead ? Alive : Dead;
+    }
+
+    void setAlive(const uint32_t *idxs, size_t len) {
+        size_t max_idx = size * size;
+        for (size_t i = 0; i < len; ++i) {
+            size_t idx = idxs[i];
+            if (idx < max_idx) {
+                cells[idx] = Alive;
+            }
+        }
+    }
+
+    Cell right(uint8_t mask = Alive) {
+        uint32_t y = idx & MASK_Y;
+        uint32_t x = ((idx | MASK_Y) + 1) & wrap_x;
+        idx = y | x;
+        if (x >= size_x || y >= size_y) {
+            return (Cell)(DeadVisited & mask);
+        }
+        return (Cell)(cells[idx] & mask);
+    }
+
+    Cell left(uint8_t mask = Alive) {
+        uint32_t y = idx & MASK_Y;
+        uint32_t x = ((idx & MASK_X) - 1) & wrap_x;
+        idx = y | x;
+        if (x >= size_x || y >= size_y) {
+            return (Cell)(DeadVisited & mask);
+        }
+        return (Cell)(cells[idx] & mask);
+    }
+
+    Cell up(uint8_t mask = Alive) {
+        uint32_t x = idx & MASK_X;
+        uint32_t y = ((idx & MASK_Y) - 1) & wrap_y;
+        idx = x | y;
+        if (y >= size_y || x >= size_x) {
+            return (Cell)(DeadVisited & mask);
+        }
+        return (Cell)(cells[idx] & mask);
+    }
+
+    Cell down(uint8_t mask = Alive) {
+        uint32_t x = idx & MASK_X;
+        uint32_t y = ((idx | MASK_X) + 1) & wrap_y;
+        idx = x | y;
+        if (y >= size_y || x >= size_x) {
+            return (Cell)(DeadVisited & mask);
+        }
+        return (Cell)(cells[idx] & mask);
+    }
+
+    unsigned char countAliveNeighbors() {
+        unsigned char count = 0;
+        size_t old_idx = idx;
+        count += up();
+        count += left();
+        count += down();
+        count += down();
+        count += right();
+        count += right();
+        count += up();
+        count += up();
+        idx = old_idx;
+        return count;
+    }
+
+    void updateCell() {
+        unsigned char alive_neighbors = countAliveNeighbors();
+        if (cells[idx] == Alive && !((rule.survive >> alive_neighbors) & 1)) {
+            cells[idx] = Dying;
+        } else if (cells[idx] == Dead) {
+            cells[idx] = (rule.birth >> alive_neighbors) & 1 ? Birthing : DeadVisited;
+        }
+    }
+
+    // relaxed atomic access for tiles stepped in parallel, which read
+    // the cells of their neighbours while those are being updated (an
+    // atomic_ref can only be taken to a mutable cell)
+    Cell load(size_t i) const {
+        return std::atomic_ref<Cell>(const_cast<Cell &>(cells[i])).load(std::memory_order_relaxed);
+    }
+
+    void store(size_t i, Cell cell) {
+        std::atomic_ref<Cell>(cells[i]).store(cell, std::memory_order_relaxed);
+    }
+
+    // unchecked for cells whose neighbours are all on the field, which on
+    // a torus is every cell
+    template <bool checked = true>
+    unsigned char countAliveNeighborsAt(uint32_t i) const {
+        uint32_t x = i & MASK_X, y = i & MASK_Y;
+        uint32_t xs[3] = {((i & MASK_X) - 1) & wrap_x, x, ((i | MASK_Y) + 1) & wrap_x};
+        uint32_t ys[3] = {((i & MASK_Y) - 1) & wrap_y, y, ((i | MASK_X) + 1) & wrap_y};
+        unsigned char count = 0;
+        for (int dy = 0; dy < 3; ++dy) {
+            if (checked && ys[dy] >= size_y) {
+                continue;
+            }
+            for (int dx = 0; dx < 3; ++dx) {
+                if ((!checked || xs[dx] < size_x) && (dx != 1 || dy != 1)) {
+                    count += load(xs[dx] | ys[dy]) & Alive;
+                }
+            }
+        }
+        return count;
+    }
+
+    // only writes cell i, unlike updateCell no DeadVisited marks are left
+    template <bool checked = true>
+    void updateCellAt(uint32_t i) {
+        Cell cell = load(i);
+        unsigned char alive_neighbors = countAliveNeighborsAt<checked>(i);
+        if (cell == Alive && !((rule.survive >> alive_neighbors) & 1)) {
+            store(i, Dying);
+        } else if (cell == Dead && ((rule.birth >> alive_neighbors) & 1)) {
+            store(i, Birthing);
+        }
+    }
+
+    void commit(size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            Cell cell = cells[i];
+            if (cell == Birthing) {
+                cells[i] = Alive;
+            } else if (cell == Dying || cell == DeadVisited) {
+                cells[i] = Dead;
+            }
+        }
+    }
+};
+
+#define ZCURVE_TILE_SIZE 64
+
+// reference engine: one byte per cell with in-place transient states
+class ZCurveEngine : public Engine {
+    ThreadPool *pool;
+    Topology edges;
+    std::unique_ptr<GameField> back;
+    size_t tile, tile_len, tiles_per_side;
+    // per tile: changed in the last generation, tiles to compute next
+    std::vector<uint8_t> changed;
+    std::vector<uint32_t> active;
+    // alive cells per tile, kept up to date by every step and edit
+    std::vector<uint32_t> tile_population;
+    TrackedHash board_hash;
+
+    // keys of the cells in [begin, end) that differ from their state in cells
+    uint64_t flippedKeys(size_t begin, size_t end, const Cell *cells) const {
+        uint64_t keys = 0;
+        for (size_t i = begin; i < end; ++i) {
+            if ((field.cells[i] ^ cells[i]) & Alive) {
+                uint16_t x, y;
+                deinterleaveXY(i, x, y);
+                keys ^= zobristKey(x, y);
+            }
+        }
+        return keys;
+    }
+
+    uint32_t countTile(const GameField &f, size_t t) const {
+        auto begin = f.cells.begin() + t * tile_len;
+        return std::count(begin, begin + tile_len, Alive);
+    }
+
+    void countTiles() {
+        for (size_t t = 0; t < tile_population.size(); ++t) {
+            tile_population[t] = countTile(field, t);
+        }
+    }
+
+    // a tile whose 3x3 tile neighbourhood did not change stays the same
+    void collectActive() {
+        active.clear();
+        size_t tiles = tiles_per_side * tiles_per_side;
+        for (uint32_t t = 0; t < tiles; ++t) {
+            uint16_t tx, ty;
+            deinterleaveXY(t, tx, ty);
+            bool dirty = false;
+            for (int dy = -1; dy <= 1 && !dirty; ++dy) {
+                for (int dx = -1; dx <= 1 && !dirty; ++dx) {
+                    size_t nx = tx + dx, ny = ty + dy;
+                    if (edges == Topology::Torus) {
+                        nx &= tiles_per_side - 1;
+                        ny &= tiles_per_side - 1;
+                    }
+                    if (nx < tiles_per_side && ny < tiles_per_side) {
+                        dirty = changed[interleaveXY(nx, ny)];
+                    }
+                }
+            }
+            if (dirty) {
+                active.push_back(t);
+            }
+        }
+        std::fill(changed.begin(), changed.end(), 0);
+    }
+
+    // tiles whose cells need no bounds checks
+    bool interior(size_t t) const {
+        if (edges == Topology::Torus) {
+            return true;
+        }
+        uint16_t tx, ty;
+        deinterleaveXY(t, tx, ty);
+        return tx && ty && tx + 1u < tiles_per_side && ty + 1u < tiles_per_side;
+    }
+
+    void forEachActive(const std::function<void(size_t)> &fn) {
+        if (pool) {
+            pool->parallelFor(active.size(), [&](size_t k) { fn(active[k]); });
+        } else {
+            for (uint32_t t : active) {
+                fn(t);
+            }
+        }
+    }
+
+    // aligned tiles of the Z-curve are contiguous ranges of cells,
+    // all of them are computed before any is committed
+    void stepTiled() {
+        collectActive();
+        forEachActive([&](size_t t) {
+            if (interior(t)) {
+                for (size_t i = t * tile_len; i < (t + 1) * tile_len; ++i) {
+                    field.updateCellAt<false>(i);
+                }
+            } else {
+                for (size_t i = t * tile_len; i < (t + 1) * tile_len; ++i) {
+                    field.updateCellAt(i);
+                }
+            }
+        });
+        std::atomic<uint64_t> keys{0};
+        forEachActive([&](size_t t) {
+            uint64_t tile_keys = 0;
+            bool dirty = false;
+            for (size_t i = t * tile_len; i < (t + 1) * tile_len; ++i) {
+                bool flips = field.cells[i] == Birthing || field.cells[i] == Dying;
+                if (flips && board_hash.tracking()) {
+                    uint16_t x, y;
+                    deinterleaveXY(i, x, y);
+                    tile_keys ^= zobristKey(x, y);
+                }
+                dirty |= flips;
+            }
+            field.commit(t * tile_len, (t + 1) * tile_len);
+            changed[t] = dirty;
+            if (dirty) {
+                tile_population[t] = countTile(field, t);
+                keys.fetch_xor(tile_keys, std::memory_order_relaxed);
+            }
+        });
+        board_hash.flip(keys);
+    }
+
+    template <bool checked = true>
+    bool stepBuffered(size_t t) {
+        Cell dirty = Dead;
+        for (size_t i = t * tile_len; i < (t + 1) * tile_len; ++i) {
+            unsigned char alive_neighbors = field.countAliveNeighborsAt<checked>(i);
+            uint16_t mask = field.cells[i] ? field.rule.survive : field.rule.birth;
+            Cell cell = (Cell)((mask >> alive_neighbors) & 1);
+            dirty = (Cell)(dirty | (cell ^ field.cells[i]));
+            back->cells[i] = cell;
+        }
+        return dirty;
+    }
+
+    // the front buffer only holds Alive and Dead, so it is read without masking,
+    // skipped tiles are unchanged and therefore equal in both buffers
+    void stepDoubleBuffered() {
+        collectActive();
+        std::atomic<uint64_t> keys{0};
+        forEachActive([&](size_t t) {
+            changed[t] = interior(t) ? stepBuffered<false>(t) : stepBuffered(t);
+            if (changed[t]) {
+                tile_population[t] = countTile(*back, t);
+                if (board_hash.tracking()) {
+                    uint64_t flipped = flippedKeys(t * tile_len, (t + 1) * tile_len,
+                        back->cells.data());
+                    keys.fetch_xor(flipped, std::memory_order_relaxed);
+                }
+            }
+        });
+        std::swap(field.cells, back->cells);
+        board_hash.flip(keys);
+    }
+
+    void markChanged() {
+        std::fill(changed.begin(), changed.end(), 1);
+        countTiles();
+        board_hash.invalidate();
+    }
+
+public:
+    GameField field;
+
+    ZCurveEngine(size_t size, const EngineOptions &options = {}) :
+        pool(options.pool), edges(options.topology), field(size)
+    {
+        checkRule(options.rule);
+        field.rule = options.rule;
+        field.setTopology(edges);
+        if (options.double_buffer) {
+            back = std::make_unique<GameField>(size);
+        }
+        tile = std::min<size_t>(size, ZCURVE_TILE_SIZE);
+        tile_len = tile * tile;
+        tiles_per_side = size / tile;
+        changed.assign(tiles_per_side * tiles_per_side, 1);
+        tile_population.assign(tiles_per_side * tiles_per_side, 0);
+    }
+
+    size_t size() const override {
+        return field.size;
+    }
+
+    Rule rule() const override {
+        return field.rule;
+    }
+
+    Topology topology() const override {
+        return edges;
+    }
+
+    bool get(int64_t x, int64_t y) const override {
+        return field.cells[interleaveXY(x, y)] == Alive;
+    }
+
+    void toggle(int64_t x, int64_t y) override {
+        field.setCursor(x, y);
+        field.toggle();
+        board_hash.flip(zobristKey(x, y));
+        changed[field.idx / tile_len] = 1;
+        tile_population[field.idx / tile_len] = countTile(field, field.idx / tile_len);
+    }
+
+    void clear() override {
+        field.clear();
+        markChanged();
+    }
+
+    // tiles are contiguous ranges of cells and filled in parallel
+    void populateRandom(const SoupOptions &soup) override {
+        auto fill = [&](size_t t) {
+            uint16_t tx, ty;
+            deinterleaveXY(t, tx, ty);
+            size_t x0 = tx * tile, y0 = ty * tile;
+            for (size_t y = y0; y < y0 + tile; ++y) {
+                uint64_t word = soupWord(soup, y, x0 >> 6, field.size) >> (x0 & 63);
+                for (size_t dx = 0; dx < tile; ++dx) {
+                    field.cells[interleaveXY(x0 + dx, y)] = (Cell)((word >> dx) & 1);
+                }
+            }
+        };
+        size_t tiles = tiles_per_side * tiles_per_side;
+        if (pool) {
+            pool->parallelFor(tiles, fill);
+        } else {
+            for (size_t t = 0; t < tiles; ++t) {
+                fill(t);
+            }
+        }
+        markChanged();
+    }
+
+    void setAlive(const uint32_t *idxs, size_t len) override {
+        field.setAlive(idxs, len);
+        markChanged();
+    }
+
+    void getAlive(std::vector<uint32_t> &idxs) const override {
+        uint32_t len = field.size * field.size;
+        for (uint32_t i = 0; i < len; ++i) {
+            if (field.cells[i] == Alive) {
+                idxs.push_back(i);
+            }
+        }
+    }
+
+    uint64_t population() const override {
+        uint64_t count = 0;
+        for (uint32_t p : tile_population) {
+            count += p;
+        }
+        return count;
+    }
+
+    // tile by tile, empty ones are skipped
+    void readRegion(int64_t x0, int64_t y0, size_t w, size_t h,
+            uint64_t *bits, size_t stride) const override
+    {
+        int64_t n = field.size, side = tile;
+        int64_t xb = std::max<int64_t>(x0, 0), xe = std::min<int64_t>(x0 + w, n);
+        int64_t yb = std::max<int64_t>(y0, 0), ye = std::min<int64_t>(y0 + h, n);
+        if (xb >= xe || yb >= ye) {
+            return;
+        }
+        for (int64_t ty = yb / side; ty <= (ye - 1) / side; ++ty) {
+            for (int64_t tx = xb / side; tx <= (xe - 1) / side; ++tx) {
+                if (!tile_population[interleaveXY(tx, ty)]) {
+                    continue;
+                }
+                int64_t x_end = std::min(xe, (tx + 1) * side), y_end = std::min(ye, (ty + 1) * side);
+                int64_t x_begin = std::max(xb, tx * side);
+                for (int64_t y = std::max(yb, ty * side); y < y_end; ++y) {
+                    uint64_t *row = &bits[(y - y0) * stride];
+                    // the x bits of the index are stepped on their own
+                    uint32_t iy = interleaveXY(0, y), ix = interleaveXY(x_begin, 0);
+                    for (int64_t x = x_begin; x < x_end; ++x) {
+                        if (field.cells[ix | iy] == Alive) {
+                            row[(x - x0) >> 6] |= 1ull << ((x - x0) & 63);
+                        }
+                        ix = ((ix | 0xaaaaaaaa) + 1) & 0x55555555;
+                    }
+                }
+            }
+        }
+    }
+
+    void writeRegion(int64_t x0, int64_t y0, size_t w, size_t h,
+            const uint64_t *bits, size_t stride) override
+    {
+        int64_t n = field.size;
+        int64_t xb = std::max<int64_t>(x0, 0), xe = std::min<int64_t>(x0 + w, n);
+        int64_t yb = std::max<int64_t>(y0, 0), ye = std::min<int64_t>(y0 + h, n);
+        if (xb >= xe || yb >= ye) {
+            return;
+        }
+        for (int64_t y = yb; y < ye; ++y) {
+            const uint64_t *row = &bits[(y - y0) * stride];
+            for (int64_t x = xb; x < xe; ++x) {
+                field.cells[interleaveXY(x, y)] = (Cell)((row[(x - x0) >> 6] >> ((x - x0) & 63)) & 1);
+            }
+        }
+        board_hash.invalidate();
+        // only the tiles the region touches are recounted
+        for (int64_t ty = yb / tile; ty <= (ye - 1) / (int64_t)tile; ++ty) {
+            for (int64_t tx = xb / tile; tx <= (xe - 1) / (int64_t)tile; ++tx) {
+                uint32_t t = interleaveXY(tx, ty);
+                changed[t] = 1;
+                tile_population[t] = countTile(field, t);
+            }
+        }
+    }
+
+    // an aligned 2^level block is a contiguous range of cells, or of tiles
+    // from the tile size up, so every block is one sum over a range
+    void readDensity(int64_t x0, int64_t y0, size_t w, size_t h, unsigned level,
+            uint32_t *counts) const override
+    {
+        int64_t side = (int64_t)field.size >> level;
+        if (side == 0) {
+            if (x0 <= 0 && y0 <= 0 && x0 + (int64_t)w > 0 && y0 + (int64_t)h > 0) {
+                counts[-y0 * w - x0] = population();
+            }
+            return;
+        }
+        size_t block_len = 1ull << (2 * level);
+        for (size_t dy = 0; dy < h; ++dy) {
+            int64_t by = y0 + dy;
+            if (by < 0 || by >= side) {
+                continue;
+            }
+            for (size_t dx = 0; dx < w; ++dx) {
+                int64_t bx = x0 + dx;
+                if (bx < 0 || bx >= side) {
+                    continue;
+                }
+                size_t begin = interleaveXY(bx << level, by << level);
+                uint32_t count = 0;
+                if (block_len >= tile_len) {
+                    for (size_t t = begin / tile_len; t < (begin + block_len) / tile_len; ++t) {
+                        count += tile_population[t];
+                    }
+                } else if (tile_population[begin / tile_len]) {
+                    // only Alive and Dead are left between steps
+                    for (size_t i = begin; i < begin + block_len; ++i) {
+                        count += field.cells[i];
+                    }
+                }
+                counts[dy * w + dx] = count;
+            }
+        }
+    }
+
+    uint64_t hash() const override {
+        return board_hash.get([&] { return Engine::hash(); });
+    }
+
+    std::unique_ptr<Engine> clone() const override {
+        EngineOptions options;
+        options.rule = field.rule;
+        options.topology = edges;
+        auto copy = std::make_unique<ZCurveEngine>(field.size, options);
+        copy->field.cells = field.cells;
+        copy->tile_population = tile_population;
+        return copy;
+    }
+
+    // the untiled loop scans the whole board
+    uint64_t cellsVisited() const override {
+        return pool || back ? active.size() * tile_len : Engine::cellsVisited();
+    }
+
+    void step() override {
+        if (back) {
+            stepDoubleBuffered();
+            return;
+        }
+        if (pool) {
+            stepTiled();
+            return;
+        }
+        const uint8_t mask = Alive | DeadVisited;
+        size_t idx = 0;
+        for (size_t y = 0; y < field.size; ++y) {
+            for (size_t x = 0; x < field.size; ++x) {
+                Cell cell = field.cells[idx];
+                if (cell == Alive) {
+                    field.idx = idx;
+                    field.updateCell();
+                    if (field.up(mask) == Dead)
+                        field.updateCell();
+                    if (field.left(mask) == Dead)
+                        field.updateCell();
+                    if (field.down(mask) == Dead)
+                        field.updateCell();
+                    if (field.down(mask) == Dead)
+                        field.updateCell();
+                    if (field.right(mask) == Dead)
+                        field.updateCell();
+                    if (field.right(mask) == Dead)
+                        field.updateCell();
+                    if (field.up(mask) == Dead)
+                        field.updateCell();
+                    if (field.up(mask) == Dead)
+                        field.updateCell();
+                }
+                ++idx;
+            }
+        }
+        // marked cells are Birthing or Dying, the rest is left as it was
+        if (board_hash.tracking()) {
+            size_t len = field.size * field.size;
+            uint64_t keys = 0;
+            for (size_t i = 0; i < len; ++i) {
+                if (field.cells[i] == Birthing || field.cells[i] == Dying) {
+                    uint16_t x, y;
+                    deinterleaveXY(i, x, y);
+                    keys ^= zobristKey(x, y);
+                }
+            }
+            board_hash.flip(keys);
+        }
+        field.commit(0, field.size * field.size);
+        countTiles();
+    }
+};
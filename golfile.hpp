@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+#include "engine.hpp"
+#include "engines.hpp"
+
+// .gol v1: the board size followed by the Z-curve index of every live cell,
+// all as native 32 bit integers
+//
+// .gol v2: a GolHeader followed by one GolTile per tile with live cells,
+// deflated as a single zlib stream when GOL_COMPRESSED is set
+#define GOL_MAGIC 0x324c4f47 // "GOL2"
+#define GOL_VERSION 2
+#define GOL_COMPRESSED 1
+#define GOL_TILE_SIZE 64
+#define GOL_WRITE_BUFFER (1 << 16)
+
+struct GolHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t flags;
+    uint64_t generation;
+    char rule[16];
+    uint64_t tiles;
+};
+
+// 64x64 cells from (x * 64, y * 64), bit (x % 64) of row (y % 64)
+struct GolTile {
+    uint32_t x, y;
+    uint64_t rows[GOL_TILE_SIZE];
+};
+
+// how far a load or save has got, in steps the format counts, and a flag
+// that stops it early; a stopped load or save returns false quietly
+struct IoProgress {
+    std::atomic<uint64_t> done{0}, total{0};
+    std::atomic<bool> cancelled{false};
+    // from the start of a load or save until its result is in place
+    std::atomic<bool> busy{false};
+
+    double fraction() const {
+        uint64_t t = total.load(std::memory_order_relaxed);
+        return t ? std::min(1.0, (double)done.load(std::memory_order_relaxed) / t) : 0;
+    }
+};
+
+inline void startProgress(IoProgress *progress, uint64_t total) {
+    if (progress) {
+        progress->done.store(0, std::memory_order_relaxed);
+        progress->total.store(total, std::memory_order_relaxed);
+    }
+}
+
+// false when the load or save is to stop
+inline bool reportProgress(IoProgress *progress, uint64_t done) {
+    if (!progress) {
+        return true;
+    }
+    progress->done.store(done, std::memory_order_relaxed);
+    return !progress->cancelled.load(std::memory_order_relaxed);
+}
+
+// read-only mapping of a whole file
+class MappedFile {
+    void *addr = MAP_FAILED;
+    size_t len = 0;
+
+public:
+    MappedFile(const std::string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            len = st.st_size;
+            addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (addr != MAP_FAILED) {
+            munmap(addr, len);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool ok() const {
+        return addr != MAP_FAILED;
+    }
+
+    const uint8_t *data() const {
+        return (const uint8_t *)addr;
+    }
+
+    size_t size() const {
+        return len;
+    }
+};
+
+// replaces field by a new engine when the board size or rule differs
+inline bool resizeField(size_t size, const std::string &engine_name,
+        const EngineOptions &options, std::unique_ptr<Engine> &field)
+{
+    if (!field || size != field->size() || field->rule() != options.rule) {
+        try {
+            field = makeEngine(engine_name, size, options);
+        } catch (const std::invalid_argument &e) {
+            std::cerr << e.what() << std::endl;
+            return false;
+        }
+    }
+    field->clear();
+    return true;
+}
+
+inline bool writeGolTile(Engine &field, const GolTile &tile) {
+    size_t n = field.size();
+    if ((uint64_t)tile.x * GOL_TILE_SIZE >= n || (uint64_t)tile.y * GOL_TILE_SIZE >= n) {
+        std::cerr << "Error: tile outside of the board" << std::endl;
+        return false;
+    }
+    field.writeRegion((int64_t)tile.x * GOL_TILE_SIZE, (int64_t)tile.y * GOL_TILE_SIZE,
+        GOL_TILE_SIZE, GOL_TILE_SIZE, tile.rows, 1);
+    return true;
+}
+
+// tiles are decoded one at a time straight from the mapping
+inline bool loadGolTiles(const GolHeader &header, const uint8_t *payload, size_t len,
+        Engine &field, IoProgress *progress = nullptr)
+{
+    startProgress(progress, header.tiles);
+    if (!(header.flags & GOL_COMPRESSED)) {
+        if (len / sizeof(GolTile) < header.tiles) {
+            std::cerr << "Error: file is truncated" << std::endl;
+            return false;
+        }
+        const GolTile *tiles = (const GolTile *)payload;
+        for (uint64_t i = 0; i < header.tiles; ++i) {
+            if (!reportProgress(progress, i) || !writeGolTile(field, tiles[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+    z_stream zs = {};
+    if (inflateInit(&zs) != Z_OK) {
+        std::cerr << "Error: " << (zs.msg ? zs.msg : "inflateInit failed") << std::endl;
+        return false;
+    }
+    zs.next_in = (Bytef *)payload;
+    zs.avail_in = len;
+    GolTile tile;
+    bool ok = true;
+    for (uint64_t i = 0; i < header.tiles && ok; ++i) {
+        if (!reportProgress(progress, i)) {
+            ok = false;
+            break;
+        }
+        zs.next_out = (Bytef *)&tile;
+        zs.avail_out = sizeof(tile);
+        int res = inflate(&zs, Z_SYNC_FLUSH);
+        if ((res != Z_OK && res != Z_STREAM_END) || zs.avail_out) {
+            std::cerr << "Error: corrupt compressed payload" << std::endl;
+            ok = false;
+        } else {
+            ok = writeGolTile(field, tile);
+        }
+    }
+    inflateEnd(&zs);
+    return ok;
+}
+
+// loads v1 and v2 files, generation is set to the one saved in v2 files
+inline bool loadGolFile(const std::string &path, const std::string &engine_name,
+        const EngineOptions &options, std::unique_ptr<Engine> &field,
+        uint64_t *generation = nullptr, IoProgress *progress = nullptr)
+{
+    MappedFile file(path);
+    if (!file.ok()) {
+        std::cerr << "Error: unable to open file " << path << std::endl;
+        return false;
+    }
+    const uint8_t *data = file.data();
+    uint32_t magic = 0;
+    std::memcpy(&magic, data, std::min<size_t>(file.size(), 4));
+    if (file.size() >= sizeof(GolHeader) && magic == GOL_MAGIC) {
+        GolHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        if (header.version != GOL_VERSION) {
+            std::cerr << "Error: unsupported .gol version " << header.version << std::endl;
+            return false;
+        }
+        EngineOptions file_options = options;
+        std::string rule(header.rule, strnlen(header.rule, sizeof(header.rule)));
+        if (!parseRule(rule, file_options.rule)) {
+            std::cerr << "Error: unsupported rule " << rule << std::endl;
+            return false;
+        }
+        if (!resizeField(header.size, engine_name, file_options, field)) {
+            return false;
+        }
+        if (generation) {
+            *generation = header.generation;
+        }
+        return loadGolTiles(header, data + sizeof(header), file.size() - sizeof(header), *field,
+            progress);
+    }
+    if (file.size() < 4 || file.size() % 4 != 0) {
+        std::cerr << "Error: wrong file format" << std::endl;
+        return false;
+    }
+    // v1 indices are used in place, the files predate other rules
+    const uint32_t *idxs = (const uint32_t *)data;
+    EngineOptions file_options = options;
+    file_options.rule = LIFE_RULE;
+    if (!resizeField(idxs[0], engine_name, file_options, field)) {
+        return false;
+    }
+    if (generation) {
+        *generation = 0;
+    }
+    field->setAlive(idxs + 1, file.size() / 4 - 1);
+    return true;
+}
+
+// collects deflated output and writes it out whenever the buffer is full
+class GolWriter {
+    std::ofstream &file;
+    bool compress;
+    z_stream zs = {};
+    std::vector<uint8_t> buffer;
+    bool ready = true;
+
+    void drain() {
+        file.write((const char *)buffer.data(), buffer.size() - zs.avail_out);
+        zs.next_out = buffer.data();
+        zs.avail_out = buffer.size();
+    }
+
+public:
+    GolWriter(std::ofstream &file, bool compress) : file(file), compress(compress) {
+        if (compress) {
+            buffer.resize(GOL_WRITE_BUFFER);
+            ready = deflateInit(&zs, Z_DEFAULT_COMPRESSION) == Z_OK;
+            zs.next_out = buffer.data();
+            zs.avail_out = buffer.size();
+        }
+    }
+
+    ~GolWriter() {
+        if (compress && ready) {
+            deflateEnd(&zs);
+        }
+    }
+
+    // false when the deflate stream could not be set up
+    bool ok() const {
+        return ready;
+    }
+
+    const char *error() const {
+        return zs.msg ? zs.msg : "deflateInit failed";
+    }
+
+    void write(const void *data, size_t len) {
+        if (!compress) {
+            file.write((const char *)data, len);
+            return;
+        }
+        zs.next_in = (Bytef *)data;
+        zs.avail_in = len;
+        while (zs.avail_in) {
+            deflate(&zs, Z_NO_FLUSH);
+            if (!zs.avail_out) {
+                drain();
+            }
+        }
+    }
+
+    void finish() {
+        if (!compress) {
+            return;
+        }
+        while (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+            drain();
+        }
+        drain();
+    }
+};
+
+// always writes v2, the tiles of a row of tiles are read from the engine
+// together, which is one request per node for cluster boards
+inline bool saveGolFile(std::string path, const Engine &field, uint64_t generation = 0,
+        bool compress = false, IoProgress *progress = nullptr)
+{
+    if (!path.ends_with(".gol")) {
+        path += ".gol";
+    }
+    std::string rule = ruleString(field.rule());
+    if (rule.size() > sizeof(GolHeader::rule)) {
+        std::cerr << "Error: rule " << rule << " does not fit a .gol header" << std::endl;
+        return false;
+    }
+    std::ofstream file(path, std::ios::binary | std::ios::out);
+    if (!file.is_open()) {
+        std::cerr << "Error: unable to open file " << path << std::endl;
+        return false;
+    }
+    GolHeader header = {};
+    header.magic = GOL_MAGIC;
+    header.version = GOL_VERSION;
+    header.size = field.size();
+    header.flags = compress ? GOL_COMPRESSED : 0;
+    header.generation = generation;
+    // not terminated when it takes all 16 bytes
+    std::memcpy(header.rule, rule.data(), rule.size());
+    file.write((const char *)&header, sizeof(header));
+    GolWriter writer(file, compress);
+    if (!writer.ok()) {
+        std::cerr << "Error: " << writer.error() << std::endl;
+        return false;
+    }
+    size_t n = field.size(), tiles = (n + GOL_TILE_SIZE - 1) / GOL_TILE_SIZE;
+    GolTile tile;
+    // a tile is one word wide
+    std::vector<uint64_t> band(tiles * GOL_TILE_SIZE);
+    startProgress(progress, tiles);
+    for (size_t ty = 0; ty < tiles; ++ty) {
+        if (!reportProgress(progress, ty)) {
+            return false;
+        }
+        std::fill(band.begin(), band.end(), 0);
+        size_t h = std::min<size_t>(GOL_TILE_SIZE, n - ty * GOL_TILE_SIZE);
+        field.readRegion(0, ty * GOL_TILE_SIZE, n, h, band.data(), tiles);
+        for (size_t tx = 0; tx < tiles; ++tx) {
+            uint64_t any = 0;
+            for (size_t r = 0; r < GOL_TILE_SIZE; ++r) {
+                tile.rows[r] = band[r * tiles + tx];
+                any |= tile.rows[r];
+            }
+            if (any) {
+                tile.x = tx;
+                tile.y = ty;
+                writer.write(&tile, sizeof(tile));
+                ++header.tiles;
+            }
+        }
+    }
+    writer.finish();
+    // the tile count is only known at the end
+    file.seekp(0);
+    file.write((const char *)&header, sizeof(header));
+    return file.good();
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "engine.hpp"
+#include "gamefield.hpp"
+#include "sparse.hpp"
+
+// one texel per cell, alive cells are black so the board can be drawn as is;
+// cells outside the board are dead like in the reference GameField unless
+// the textures repeat, LIFE_RULE_CONDITION is replaced by gpuRuleCondition
+static const char *GPU_LIFE_SHADER = R"(
+uniform sampler2D state;
+uniform vec2 size;
+uniform bool torus;
+
+float alive(vec2 p) {
+    if (!torus && (p.x < 0.0 || p.y < 0.0 || p.x >= size.x || p.y >= size.y)) {
+        return 0.0;
+    }
+    return 1.0 - step(0.5, texture2D(state, (p + 0.5) / size).r);
+}
+
+void main() {
+    vec2 p = floor(gl_FragCoord.xy);
+    float count = alive(p + vec2(-1.0, -1.0)) + alive(p + vec2(0.0, -1.0))
+        + alive(p + vec2(1.0, -1.0)) + alive(p + vec2(-1.0, 0.0))
+        + alive(p + vec2(1.0, 0.0)) + alive(p + vec2(-1.0, 1.0))
+        + alive(p + vec2(0.0, 1.0)) + alive(p + vec2(1.0, 1.0));
+    float self = alive(p);
+    float next = LIFE_RULE_CONDITION ? 0.0 : 1.0;
+    gl_FragColor = vec4(next, next, next, 1.0);
+}
+)";
+
+// the rule as a glsl expression of count and self, baked into the shader
+inline std::string gpuRuleCondition(const Rule &rule) {
+    auto counts = [](uint16_t mask) {
+        std::string s;
+        for (int k = 0; k <= 8; ++k) {
+            if ((mask >> k) & 1) {
+                s += (s.empty() ? "" : " || ") + std::string("count == ") + std::to_string(k) + ".0";
+            }
+        }
+        return s.empty() ? std::string("false") : "(" + s + ")";
+    };
+    return "(self == 1.0 ? " + counts(rule.survive) + " : " + counts(rule.birth) + ")";
+}
+
+inline std::string gpuLifeShader(const Rule &rule) {
+    std::string source = GPU_LIFE_SHADER;
+    const std::string token = "LIFE_RULE_CONDITION";
+    source.replace(source.find(token), token.size(), gpuRuleCondition(rule));
+    return source;
+}
+
+// the board lives in two render textures and every step is one fragment
+// shader pass from the current into the other, the cells are only read back
+// for get, population and files
+class GpuField : public Engine {
+    size_t n;
+    Rule life_rule;
+    Topology edges;
+    sf::RenderTexture textures[2];
+    int current = 0;
+    sf::Shader shader;
+    sf::Texture upload;
+    mutable sf::Image image;
+    mutable bool image_stale = true;
+
+    const sf::Image &readBack() const {
+        if (image_stale) {
+            image = textures[current].getTexture().copyToImage();
+            image_stale = false;
+        }
+        return image;
+    }
+
+    // replaces the board with rgba pixels in row order
+    void uploadPixels(const std::vector<uint8_t> &pixels) {
+        upload.update(pixels.data());
+        textures[current].draw(sf::Sprite(upload), sf::BlendNone);
+        textures[current].display();
+        image_stale = true;
+    }
+
+    static void setPixel(std::vector<uint8_t> &pixels, size_t i, bool alive) {
+        uint8_t v = alive ? 0 : 255;
+        pixels[i * 4] = pixels[i * 4 + 1] = pixels[i * 4 + 2] = v;
+        pixels[i * 4 + 3] = 255;
+    }
+
+public:
+    GpuField(size_t size, const EngineOptions &options = {}) :
+        n(size), life_rule(options.rule), edges(options.topology)
+    {
+        checkRule(options.rule);
+        if (!sf::Shader::isAvailable()) {
+            throw std::invalid_argument("shaders are not available on this system");
+        }
+        if (size == 0 || size > sf::Texture::getMaximumSize() || size > 65536) {
+            throw std::invalid_argument("board size needs to be in [1, "
+                + std::to_string(std::min(sf::Texture::getMaximumSize(), 65536u)) + "]");
+        }
+        // clones go through a sparse field, which only wraps at whole chunks
+        if (edges == Topology::Torus && size % CHUNK_SIZE) {
+            throw std::invalid_argument("a gpu torus needs a multiple of 64 as size");
+        }
+        for (sf::RenderTexture &texture : textures) {
+            if (!texture.create(n, n)) {
+                throw std::invalid_argument("could not create a render texture");
+            }
+            texture.setSmooth(false);
+            // sampling past the edges wraps to the other side
+            texture.setRepeated(edges == Topology::Torus);
+            texture.clear(sf::Color::White);
+            texture.display();
+        }
+        if (!upload.create(n, n) || !shader.loadFromMemory(gpuLifeShader(life_rule), sf::Shader::Fragment)) {
+            throw std::invalid_argument("could not set up the life shader");
+        }
+        shader.setUniform("state", sf::Shader::CurrentTexture);
+        shader.setUniform("size", sf::Vector2f(n, n));
+        shader.setUniform("torus", edges == Topology::Torus);
+    }
+
+    size_t size() const override {
+        return n;
+    }
+
+    Rule rule() const override {
+        return life_rule;
+    }
+
+    Topology topology() const override {
+        return edges;
+    }
+
+    bool get(int64_t x, int64_t y) const override {
+        return readBack().getPixel(x, y).r < 128;
+    }
+
+    // inverts the colour of one texel, no read back needed
+    void toggle(int64_t x, int64_t y) override {
+        static const sf::BlendMode invert(sf::BlendMode::OneMinusDstColor, sf::BlendMode::Zero,
+            sf::BlendMode::Add, sf::BlendMode::Zero, sf::BlendMode::One, sf::BlendMode::Add);
+        sf::Vertex quad[4] = {
+            sf::Vertex(sf::Vector2f(x, y), sf::Color::White),
+            sf::Vertex(sf::Vector2f(x + 1, y), sf::Color::White),
+            sf::Vertex(sf::Vector2f(x + 1, y + 1), sf::Color::White),
+            sf::Vertex(sf::Vector2f(x, y + 1), sf::Color::White),
+        };
+        textures[current].draw(quad, 4, sf::Quads, invert);
+        textures[current].display();
+        image_stale = true;
+    }
+
+    void clear() override {
+        textures[current].clear(sf::Color::White);
+        textures[current].display();
+        image_stale = true;
+    }
+
+    void populateRandom(const SoupOptions &soup) override {
+        std::vector<uint8_t> pixels(n * n * 4);
+        for (size_t y = 0; y < n; ++y) {
+            for (size_t x = 0; x < n; x += 64) {
+                uint64_t bits = soupWord(soup, y, x / 64, n);
+                for (size_t b = 0; b < 64 && x + b < n; ++b) {
+                    setPixel(pixels, y * n + x + b, (bits >> b) & 1);
+                }
+            }
+        }
+        uploadPixels(pixels);
+    }
+
+    void setAlive(const uint32_t *idxs, size_t len) override {
+        const uint8_t *old = readBack().getPixelsPtr();
+        std::vector<uint8_t> pixels(old, old + n * n * 4);
+        for (size_t i = 0; i < len; ++i) {
+            uint16_t x, y;
+            deinterleaveXY(idxs[i], x, y);
+            if (x < n && y < n) {
+                setPixel(pixels, (size_t)y * n + x, true);
+            }
+        }
+        uploadPixels(pixels);
+    }
+
+    // uploads just the rectangle the region covers
+    void writeRegion(int64_t x0, int64_t y0, size_t w, size_t h,
+            const uint64_t *bits, size_t stride) override
+    {
+        int64_t xb = std::max<int64_t>(x0, 0), xe = std::min<int64_t>(x0 + w, n);
+        int64_t yb = std::max<int64_t>(y0, 0), ye = std::min<int64_t>(y0 + h, n);
+        if (xb >= xe || yb >= ye) {
+            return;
+        }
+        std::vector<uint8_t> pixels((xe - xb) * (ye - yb) * 4);
+        size_t i = 0;
+        for (int64_t y = yb; y < ye; ++y) {
+            for (int64_t x = xb; x < xe; ++x) {
+                setPixel(pixels, i++, (bits[(y - y0) * stride + ((x - x0) >> 6)] >> ((x - x0) & 63)) & 1);
+            }
+        }
+        upload.update(pixels.data(), xe - xb, ye - yb, xb, yb);
+        sf::Sprite patch(upload, sf::IntRect(xb, yb, xe - xb, ye - yb));
+        patch.setPosition(xb, yb);
+        textures[current].draw(patch, sf::BlendNone);
+        textures[current].display();
+        image_stale = true;
+    }
+
+    void getAlive(std::vector<uint32_t> &idxs) const override {
+        size_t first = idxs.size();
+        const uint8_t *pixels = readBack().getPixelsPtr();
+        for (size_t y = 0; y < n; ++y) {
+            for (size_t x = 0; x < n; ++x) {
+                if (pixels[(y * n + x) * 4] < 128) {
+                    idxs.push_back(interleaveXY(x, y));
+                }
+            }
+        }
+        std::sort(idxs.begin() + first, idxs.end());
+    }
+
+    uint64_t population() const override {
+        const uint8_t *pixels = readBack().getPixelsPtr();
+        uint64_t count = 0;
+        for (size_t i = 0; i < n * n; ++i) {
+            count += pixels[i * 4] < 128;
+        }
+        return count;
+    }
+
+    void step() override {
+        sf::RenderTexture &next = textures[current ^ 1];
+        sf::RenderStates states(&shader);
+        states.blendMode = sf::BlendNone;
+        next.draw(sf::Sprite(textures[current].getTexture()), states);
+        next.display();
+        current ^= 1;
+        image_stale = true;
+    }
+
+    // read back into a sparse field, textures cannot be used by other threads
+    std::unique_ptr<Engine> clone() const override {
+        EngineOptions options;
+        options.rule = life_rule;
+        options.topology = edges;
+        auto copy = std::make_unique<SparseField>(n, options);
+        std::vector<uint32_t> idxs;
+        getAlive(idxs);
+        copy->setAlive(idxs.data(), idxs.size());
+        return copy;
+    }
+
+    // copies the board into a texture of the same size, stays on the gpu
+    void drawTo(sf::RenderTexture &target) const {
+        target.draw(sf::Sprite(textures[current].getTexture()), sf::BlendNone);
+        target.display();
+    }
+};
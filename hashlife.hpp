@@ -0,0 +1,532 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include "engine.hpp"
+#include "gamefield.hpp"
+
+#define HASHLIFE_MAX_NODES (1 << 23)
+
+struct HashNode {
+    HashNode *nw, *ne, *sw, *se;
+    // memoized centre after 2^min(level - 2, step) generations
+    HashNode *result;
+    HashNode *next;
+    uint64_t population;
+    uint8_t level;
+};
+
+// hash-consed quadtree, the board of size n is centred on the origin of an
+// unbounded universe, files only cover the board
+class HashLife : public Engine {
+    std::deque<HashNode> nodes;
+    std::vector<HashNode *> table;
+    std::vector<HashNode *> empty;
+    HashNode *dead, *alive;
+    HashNode *root;
+    size_t n;
+    uint8_t n_level;
+    unsigned step_exp;
+    unsigned result_exp;
+    Rule life_rule;
+
+    static size_t hash(HashNode *nw, HashNode *ne, HashNode *sw, HashNode *se) {
+        size_t h = (size_t)nw;
+        h = h * 0x9e3779b97f4a7c15ull + (size_t)ne;
+        h = h * 0x9e3779b97f4a7c15ull + (size_t)sw;
+        h = h * 0x9e3779b97f4a7c15ull + (size_t)se;
+        return h ^ (h >> 29);
+    }
+
+    HashNode *alloc(HashNode *nw, HashNode *ne, HashNode *sw, HashNode *se,
+            uint64_t population, uint8_t level)
+    {
+        nodes.push_back({nw, ne, sw, se, nullptr, nullptr, population, level});
+        return &nodes.back();
+    }
+
+    void rehash() {
+        std::vector<HashNode *> old(table.size() * 2, nullptr);
+        old.swap(table);
+        for (HashNode *head : old) {
+            while (head) {
+                HashNode *next = head->next;
+                size_t h = hash(head->nw, head->ne, head->sw, head->se) & (table.size() - 1);
+                head->next = table[h];
+                table[h] = head;
+                head = next;
+            }
+        }
+    }
+
+    void reset() {
+        nodes.clear();
+        table.assign(1 << 16, nullptr);
+        empty.clear();
+        dead = alloc(nullptr, nullptr, nullptr, nullptr, 0, 0);
+        alive = alloc(nullptr, nullptr, nullptr, nullptr, 1, 0);
+        empty.push_back(dead);
+    }
+
+    HashNode *emptyNode(uint8_t level) {
+        while (empty.size() <= level) {
+            HashNode *e = empty.back();
+            empty.push_back(node(e, e, e, e));
+        }
+        return empty[level];
+    }
+
+    // rebuilds the table with only the nodes reachable from the root
+    void collect() {
+        std::deque<HashNode> old;
+        old.swap(nodes);
+        HashNode *old_alive = alive;
+        reset();
+        std::unordered_map<HashNode *, HashNode *> copies;
+        copies[old_alive] = alive;
+        root = copy(root, copies);
+    }
+
+    HashNode *copy(HashNode *old, std::unordered_map<HashNode *, HashNode *> &copies) {
+        if (old->population == 0) {
+            return emptyNode(old->level);
+        }
+        auto it = copies.find(old);
+        if (it != copies.end()) {
+            return it->second;
+        }
+        HashNode *res = node(copy(old->nw, copies), copy(old->ne, copies),
+            copy(old->sw, copies), copy(old->se, copies));
+        copies[old] = res;
+        return res;
+    }
+
+    HashNode *expand(HashNode *r) {
+        HashNode *e = emptyNode(r->level - 1);
+        return node(
+            node(e, e, e, r->nw), node(e, e, r->ne, e),
+            node(e, r->sw, e, e), node(r->se, e, e, e));
+    }
+
+    HashNode *centre(HashNode *m) {
+        return node(m->nw->se, m->ne->sw, m->sw->ne, m->se->nw);
+    }
+
+    HashNode *centreHorizontal(HashNode *w, HashNode *e) {
+        return node(w->ne, e->nw, w->se, e->sw);
+    }
+
+    HashNode *centreVertical(HashNode *n, HashNode *s) {
+        return node(n->sw, n->se, s->nw, s->ne);
+    }
+
+    // one generation of the centre 2x2 of a 4x4 node
+    HashNode *stepLevel2(HashNode *m) {
+        HashNode *quads[4] = {m->nw, m->ne, m->sw, m->se};
+        uint16_t bits = 0;
+        for (int q = 0; q < 4; ++q) {
+            HashNode *leaves[4] = {quads[q]->nw, quads[q]->ne, quads[q]->sw, quads[q]->se};
+            for (int l = 0; l < 4; ++l) {
+                int x = (q & 1) * 2 + (l & 1), y = (q >> 1) * 2 + (l >> 1);
+                bits |= (uint16_t)(leaves[l] == alive) << (y * 4 + x);
+            }
+        }
+        HashNode *res[4];
+        for (int i = 0; i < 4; ++i) {
+            int cx = 1 + (i & 1), cy = 1 + (i >> 1);
+            int count = 0;
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    if (dx || dy) {
+                        count += (bits >> ((cy + dy) * 4 + cx + dx)) & 1;
+                    }
+                }
+            }
+            bool self = (bits >> (cy * 4 + cx)) & 1;
+            uint16_t mask = self ? life_rule.survive : life_rule.birth;
+            res[i] = (mask >> count) & 1 ? alive : dead;
+        }
+        return node(res[0], res[1], res[2], res[3]);
+    }
+
+    // centre of m after 2^min(level - 2, step_exp) generations
+    HashNode *next(HashNode *m) {
+        if (m->result) {
+            return m->result;
+        }
+        HashNode *res;
+        if (m->population == 0) {
+            res = emptyNode(m->level - 1);
+        } else if (m->level == 2) {
+            res = stepLevel2(m);
+        } else {
+            HashNode *n00 = m->nw, *n01 = centreHorizontal(m->nw, m->ne), *n02 = m->ne;
+            HashNode *n10 = centreVertical(m->nw, m->sw), *n11 = centre(m);
+            HashNode *n12 = centreVertical(m->ne, m->se);
+            HashNode *n20 = m->sw, *n21 = centreHorizontal(m->sw, m->se), *n22 = m->se;
+            HashNode *sub[9] = {n00, n01, n02, n10, n11, n12, n20, n21, n22};
+            // at full speed both halves advance, otherwise only the second
+            bool full = m->level - 2u <= step_exp;
+            for (HashNode *&s : sub) {
+                s = full ? next(s) : centre(s);
+            }
+            res = node(
+                next(node(sub[0], sub[1], sub[3], sub[4])),
+                next(node(sub[1], sub[2], sub[4], sub[5])),
+                next(node(sub[3], sub[4], sub[6], sub[7])),
+                next(node(sub[4], sub[5], sub[7], sub[8])));
+        }
+        m->result = res;
+        return res;
+    }
+
+    HashNode *set(HashNode *m, uint64_t x, uint64_t y, bool value) {
+        if (m->level == 0) {
+            return value ? alive : dead;
+        }
+        uint64_t half = 1ull << (m->level - 1);
+        bool east = x >= half, south = y >= half;
+        x &= half - 1;
+        y &= half - 1;
+        HashNode *q[4] = {m->nw, m->ne, m->sw, m->se};
+        HashNode *&c = q[south * 2 + east];
+        c = set(c, x, y, value);
+        return node(q[0], q[1], q[2], q[3]);
+    }
+
+    // from Z-curve indices sorted ascending, all within [base, base + 4^level)
+    HashNode *build(const uint32_t *begin, const uint32_t *end, uint64_t base, uint8_t level) {
+        if (begin == end) {
+            return emptyNode(level);
+        }
+        if (level == 0) {
+            return alive;
+        }
+        uint64_t quarter = 1ull << (2 * (level - 1));
+        HashNode *q[4];
+        for (int i = 0; i < 4; ++i) {
+            const uint32_t *split = std::lower_bound(begin, end, base + (i + 1) * quarter);
+            q[i] = build(begin, split, base + i * quarter, level - 1);
+            begin = split;
+        }
+        return node(q[0], q[1], q[2], q[3]);
+    }
+
+    HashNode *merge(HashNode *a, HashNode *b) {
+        if (a->population == 0) {
+            return b;
+        }
+        if (b->population == 0 || a == b) {
+            return a;
+        }
+        if (a->level == 0) {
+            return alive;
+        }
+        return node(merge(a->nw, b->nw), merge(a->ne, b->ne),
+            merge(a->sw, b->sw), merge(a->se, b->se));
+    }
+
+    // board cells (x0, y0) of a node at the given offset, within [0, n)
+    void collectAlive(const HashNode *m, int64_t x0, int64_t y0,
+            std::vector<uint32_t> &idxs) const
+    {
+        int64_t side = 1ll << m->level;
+        if (m->population == 0 || x0 >= (int64_t)n || y0 >= (int64_t)n
+                || x0 + side <= 0 || y0 + side <= 0) {
+            return;
+        }
+        if (m->level == 0) {
+            idxs.push_back(interleaveXY(x0, y0));
+            return;
+        }
+        int64_t half = side / 2;
+        collectAlive(m->nw, x0, y0, idxs);
+        collectAlive(m->ne, x0 + half, y0, idxs);
+        collectAlive(m->sw, x0, y0 + half, idxs);
+        collectAlive(m->se, x0 + half, y0 + half, idxs);
+    }
+
+    // board coordinates of the root's top left corner
+    int64_t rootOrigin() const {
+        return (int64_t)(n / 2) - (1ll << (root->level - 1));
+    }
+
+    void setBoard(int64_t x, int64_t y, bool value) {
+        while (root->level < 62) {
+            int64_t origin = rootOrigin();
+            int64_t side = 1ll << root->level;
+            if (x - origin < side && y - origin < side && x >= origin && y >= origin) {
+                break;
+            }
+            root = expand(root);
+        }
+        int64_t origin = rootOrigin();
+        root = set(root, x - origin, y - origin, value);
+    }
+
+    void densityOf(const HashNode *m, int64_t x, int64_t y, int64_t x0, int64_t y0,
+            size_t w, size_t h, unsigned level, uint32_t *counts) const
+    {
+        int64_t span = 1ll << m->level;
+        int64_t bx = x >> level, by = y >> level;
+        int64_t bx1 = (x + span - 1) >> level, by1 = (y + span - 1) >> level;
+        if (!m->population || bx1 < x0 || by1 < y0
+                || bx >= x0 + (int64_t)w || by >= y0 + (int64_t)h) {
+            return;
+        }
+        if (bx == bx1 && by == by1) {
+            counts[(by - y0) * w + (bx - x0)] += m->population;
+            return;
+        }
+        int64_t half = span / 2;
+        densityOf(m->nw, x, y, x0, y0, w, h, level, counts);
+        densityOf(m->ne, x + half, y, x0, y0, w, h, level, counts);
+        densityOf(m->sw, x, y + half, x0, y0, w, h, level, counts);
+        densityOf(m->se, x + half, y + half, x0, y0, w, h, level, counts);
+    }
+
+    // keys of the live cells of m, whose top left corner is (x, y)
+    static uint64_t keysOf(const HashNode *m, int64_t x, int64_t y) {
+        if (!m->population) {
+            return 0;
+        }
+        if (!m->level) {
+            return zobristKey(x, y);
+        }
+        int64_t half = 1ll << (m->level - 1);
+        return keysOf(m->nw, x, y) ^ keysOf(m->ne, x + half, y)
+            ^ keysOf(m->sw, x, y + half) ^ keysOf(m->se, x + half, y + half);
+    }
+
+public:
+    uint64_t generation = 0;
+
+    HashLife(size_t size, const EngineOptions &options = {}) :
+        n(size), step_exp(options.step_exp), result_exp(options.step_exp), life_rule(options.rule)
+    {
+        checkRule(options.rule);
+        if (options.topology == Topology::Torus) {
+            throw std::invalid_argument("hashlife has no torus mode");
+        }
+        if (size < 4 || (size & (size - 1))) {
+            throw std::invalid_argument("size needs to be power of 2 and at least 4");
+        }
+        if (size > 65536) {
+            throw std::invalid_argument("size >65536 not supported");
+        }
+        n_level = __builtin_ctzll(size);
+        reset();
+        root = emptyNode(n_level);
+    }
+
+    HashNode *node(HashNode *nw, HashNode *ne, HashNode *sw, HashNode *se) {
+        size_t h = hash(nw, ne, sw, se);
+        for (HashNode *c = table[h & (table.size() - 1)]; c; c = c->next) {
+            if (c->nw == nw && c->ne == ne && c->sw == sw && c->se == se) {
+                return c;
+            }
+        }
+        HashNode *res = alloc(nw, ne, sw, se,
+            nw->population + ne->population + sw->population + se->population,
+            nw->level + 1);
+        res->next = table[h & (table.size() - 1)];
+        table[h & (table.size() - 1)] = res;
+        if (nodes.size() > table.size()) {
+            rehash();
+        }
+        return res;
+    }
+
+    size_t size() const override {
+        return n;
+    }
+
+    Rule rule() const override {
+        return life_rule;
+    }
+
+    bool bounded() const override {
+        return false;
+    }
+
+    bool get(int64_t x, int64_t y) const override {
+        int64_t origin = rootOrigin();
+        uint64_t ux = x - origin, uy = y - origin;
+        if (ux >> root->level || uy >> root->level) {
+            return false;
+        }
+        const HashNode *m = root;
+        while (m->level && m->population) {
+            uint64_t half = 1ull << (m->level - 1);
+            bool east = ux & half, south = uy & half;
+            m = south ? (east ? m->se : m->sw) : (east ? m->ne : m->nw);
+        }
+        return m == alive;
+    }
+
+    void toggle(int64_t x, int64_t y) override {
+        setBoard(x, y, !get(x, y));
+    }
+
+    void clear() override {
+        reset();
+        root = emptyNode(n_level);
+    }
+
+    void populateRandom(const SoupOptions &soup) override {
+        std::vector<uint32_t> idxs;
+        for (size_t y = 0; y < n; ++y) {
+            for (size_t j = 0; j * 64 < n; ++j) {
+                uint64_t bits = soupWord(soup, y, j, n);
+                while (bits) {
+                    idxs.push_back(interleaveXY(j * 64 + __builtin_ctzll(bits), y));
+                    bits &= bits - 1;
+                }
+            }
+        }
+        clear();
+        setAlive(idxs.data(), idxs.size());
+    }
+
+    void setAlive(const uint32_t *idxs, size_t len) override {
+        std::vector<uint32_t> sorted;
+        uint64_t max_idx = (uint64_t)n * n;
+        for (size_t i = 0; i < len; ++i) {
+            if (idxs[i] < max_idx) {
+                sorted.push_back(idxs[i]);
+            }
+        }
+        std::sort(sorted.begin(), sorted.end());
+        sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+        // the board is the centred node of level n_level in a root of that level
+        HashNode *board = build(sorted.data(), sorted.data() + sorted.size(), 0, n_level);
+        while (root->level < n_level) {
+            root = expand(root);
+        }
+        HashNode *placed = board;
+        while (placed->level < root->level) {
+            placed = expand(placed);
+        }
+        root = merge(root, placed);
+    }
+
+    void getAlive(std::vector<uint32_t> &idxs) const override {
+        size_t first = idxs.size();
+        int64_t origin = rootOrigin();
+        collectAlive(root, origin, origin, idxs);
+        std::sort(idxs.begin() + first, idxs.end());
+    }
+
+    void load(const Engine &other) {
+        std::vector<uint32_t> idxs;
+        other.getAlive(idxs);
+        clear();
+        setAlive(idxs.data(), idxs.size());
+    }
+
+    void exportTo(Engine &other) const {
+        std::vector<uint32_t> idxs;
+        getAlive(idxs);
+        other.clear();
+        other.setAlive(idxs.data(), idxs.size());
+    }
+
+    // every cell of other, also the ones off its board, centred on this board
+    void copyFrom(const HashLife &other) {
+        std::unordered_map<HashNode *, HashNode *> copies;
+        copies[other.alive] = alive;
+        clear();
+        setRoot(copy(other.root, copies));
+    }
+
+    // only the nodes reachable from the root are copied
+    std::unique_ptr<Engine> clone() const override {
+        EngineOptions options;
+        options.step_exp = step_exp;
+        options.rule = life_rule;
+        auto copy = std::make_unique<HashLife>(n, options);
+        std::unordered_map<HashNode *, HashNode *> copies;
+        copies[alive] = copy->alive;
+        copy->root = copy->copy(root, copies);
+        copy->generation = generation;
+        return copy;
+    }
+
+    // building blocks for importers, nodes stay valid until the next step
+    HashNode *leaf(bool value) const {
+        return value ? alive : dead;
+    }
+
+    HashNode *emptyOf(uint8_t level) {
+        return emptyNode(level);
+    }
+
+    // the root is kept centred on the board and at least as large as it
+    void setRoot(HashNode *m) {
+        root = m;
+        while (root->level < n_level) {
+            root = expand(root);
+        }
+    }
+
+    const HashNode *grownRoot(uint8_t level) {
+        while (root->level < level) {
+            root = expand(root);
+        }
+        return root;
+    }
+
+    uint64_t population() const override {
+        return root->population;
+    }
+
+    // of every live cell, also the ones off the board, as sparse does
+    uint64_t hash() const override {
+        int64_t origin = rootOrigin();
+        return keysOf(root, origin, origin);
+    }
+
+    // whole nodes are added to their block without descending into them
+    void readDensity(int64_t x0, int64_t y0, size_t w, size_t h, unsigned level,
+            uint32_t *counts) const override
+    {
+        int64_t origin = rootOrigin();
+        densityOf(root, origin, origin, x0, y0, w, h, level, counts);
+    }
+
+    // 2^k generations in one call
+    void advance(unsigned k) {
+        if (k != result_exp) {
+            for (HashNode &m : nodes) {
+                m.result = nullptr;
+            }
+            result_exp = k;
+        }
+        step_exp = k;
+        if (root->population) {
+            // the pattern has to stay inside the centre the result covers
+            while (root->level < k + 3 || root->level < 3
+                    || root->nw->se->se->population + root->ne->sw->sw->population
+                    + root->sw->ne->ne->population + root->se->nw->nw->population
+                    != root->population) {
+                root = expand(root);
+            }
+            root = next(root);
+            if (nodes.size() > HASHLIFE_MAX_NODES) {
+                collect();
+            }
+        }
+        generation += 1ull << k;
+    }
+
+    void step() override {
+        advance(step_exp);
+    }
+
+    uint64_t generationsPerStep() const override {
+        return 1ull << step_exp;
+    }
+};
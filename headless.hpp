@@ -0,0 +1,198 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "engine.hpp"
+#include "checkpoint.hpp"
+#include "cycles.hpp"
+#include "engines.hpp"
+#include "patterns.hpp"
+
+#define BENCH_MIN_SECONDS 1.0
+// per choice when the time block is picked before a run
+#define TIME_BLOCK_TUNE_SECONDS 0.1
+
+static const unsigned TIME_BLOCK_CHOICES[] = {1, 2, 4, 8, 16};
+
+struct RunResult {
+    uint64_t generations;
+    double seconds;
+    uint64_t population;
+    // set when cycles were looked for, period 0 if none was found
+    const CycleDetector *cycles = nullptr;
+};
+
+// steps as fast as possible until both limits are reached or the board
+// cycles, checkpoints and cycles get the generation counted from first_generation
+inline RunResult runGenerations(Engine &field, uint64_t generations, double min_seconds = 0,
+        Checkpointer *checkpoints = nullptr, uint64_t first_generation = 0,
+        CycleDetector *cycles = nullptr)
+{
+    auto start = std::chrono::steady_clock::now();
+    RunResult res = {0, 0, 0, cycles};
+    if (cycles) {
+        cycles->update(field, first_generation);
+    }
+    // a time blocked swar board ends on the exact count, one generation at a time
+    BitField *bits = dynamic_cast<BitField *>(&field);
+    while (res.generations < generations || res.seconds < min_seconds) {
+        if (bits && res.generations < generations
+                && generations - res.generations < field.generationsPerStep()) {
+            bits->stepSingle();
+            ++res.generations;
+        } else {
+            field.step();
+            res.generations += field.generationsPerStep();
+        }
+        uint64_t generation = first_generation + res.generations;
+        if (checkpoints) {
+            checkpoints->update(field, generation);
+        }
+        res.seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        if (cycles && cycles->update(field, generation) && cycles->shouldStop()) {
+            break;
+        }
+    }
+    res.population = field.population();
+    return res;
+}
+
+inline void printResult(const std::string &engine_name, const std::string &pattern,
+        size_t size, const RunResult &res)
+{
+    double cells = (double)size * size * res.generations;
+    // rates of a run that took no time are 0 rather than nan or inf
+    double per_second = res.seconds > 0 ? 1 / res.seconds : 0;
+    std::printf("engine=%s pattern=%s size=%zu generations=%llu seconds=%.3f "
+        "gen/s=%.1f cell-updates/s=%.3e population=%llu",
+        engine_name.c_str(), pattern.c_str(), size, (unsigned long long)res.generations,
+        res.seconds, res.generations * per_second, cells * per_second,
+        (unsigned long long)res.population);
+    if (res.cycles) {
+        std::printf(" period=%llu", (unsigned long long)res.cycles->period());
+        if (res.cycles->period()) {
+            std::printf(" repeats=%llu", (unsigned long long)res.cycles->start());
+        }
+    }
+    std::printf("\n");
+}
+
+// steps a soup of the board size at every time block of swar for the given
+// time each and returns the one with the most generations per second
+inline unsigned tuneTimeBlock(size_t size, const EngineOptions &options, const SoupOptions &soup,
+        double seconds, bool print = false)
+{
+    unsigned best = 1;
+    double best_rate = 0;
+    for (unsigned k : TIME_BLOCK_CHOICES) {
+        EngineOptions block_options = options;
+        block_options.time_block = k;
+        BitField field(size, block_options);
+        field.populateRandom(soup);
+        RunResult res = runGenerations(field, 1, seconds);
+        double rate = res.generations / res.seconds;
+        if (print) {
+            std::printf("engine=swar pattern=soup size=%zu time-block=%u gen/s=%.1f\n",
+                size, k, rate);
+        }
+        if (rate > best_rate) {
+            best = k;
+            best_rate = rate;
+        }
+    }
+    if (print) {
+        std::printf("best time-block=%u\n", best);
+    }
+    return best;
+}
+
+// runs the file for the given number of generations without a window, a
+// resumed checkpoint only runs the generations left; a swar board given
+// tune_soup is stepped at the time block fastest for its size
+inline int runHeadless(const std::string &path, const std::string &engine_name,
+        const EngineOptions &options, uint64_t generations,
+        const CheckpointOptions &checkpoint = {}, CycleDetector *cycles = nullptr,
+        const SoupOptions *tune_soup = nullptr)
+{
+    std::unique_ptr<Engine> field;
+    uint64_t generation = 0;
+    bool resumed = checkpoint.canResume();
+    std::string source = resumed ? patternPath(checkpoint.path) : path;
+    if (!loadPattern(source, engine_name, options, field, &generation)) {
+        return 1;
+    }
+    if (tune_soup && engine_name == "swar") {
+        // the size is only known once loaded, the board moves to a blocked one
+        size_t n = field->size();
+        EngineOptions tuned = options;
+        tuned.rule = field->rule();
+        tuned.time_block = tuneTimeBlock(n, tuned, *tune_soup, TIME_BLOCK_TUNE_SECONDS);
+        size_t stride = (n + 63) / 64;
+        std::vector<uint64_t> bits(stride * n);
+        field->readRegion(0, 0, n, n, bits.data(), stride);
+        field = makeEngine(engine_name, n, tuned);
+        field->writeRegion(0, 0, n, n, bits.data(), stride);
+    }
+    std::unique_ptr<Checkpointer> checkpoints;
+    if (!checkpoint.path.empty()) {
+        checkpoints = std::make_unique<Checkpointer>(checkpoint, generation);
+    }
+    // other files run all of them, counted on from the generation they carry
+    uint64_t left = !resumed ? generations : generations > generation ? generations - generation : 0;
+    printResult(engine_name, source, field->size(),
+        runGenerations(*field, left, 0, checkpoints.get(), generation, cycles));
+    return 0;
+}
+
+// Gosper glider gun, (x, y) pairs
+static const int GLIDER_GUN[][2] = {
+    {24, 0}, {22, 1}, {24, 1}, {12, 2}, {13, 2}, {20, 2}, {21, 2}, {34, 2}, {35, 2},
+    {11, 3}, {15, 3}, {20, 3}, {21, 3}, {34, 3}, {35, 3}, {0, 4}, {1, 4}, {10, 4},
+    {16, 4}, {20, 4}, {21, 4}, {0, 5}, {1, 5}, {10, 5}, {14, 5}, {16, 5}, {17, 5},
+    {22, 5}, {24, 5}, {10, 6}, {16, 6}, {24, 6}, {11, 7}, {15, 7}, {12, 8}, {13, 8},
+};
+
+inline void placeGliderGun(Engine &field, int64_t x0, int64_t y0) {
+    for (const auto &cell : GLIDER_GUN) {
+        field.toggle(x0 + cell[0], y0 + cell[1]);
+    }
+}
+
+
+// random soup, glider gun and empty board at several sizes, each case runs
+// at least the given generations and BENCH_MIN_SECONDS; swar then runs the
+// soup of the largest size at every time block
+inline int runBenchmark(const std::string &engine_name, const EngineOptions &options,
+        uint64_t generations, const SoupOptions &soup)
+{
+    const size_t sizes[] = {256, 1024, 4096};
+    const char *patterns[] = {"soup", "gun", "empty"};
+    for (size_t size : sizes) {
+        for (const char *pattern : patterns) {
+            std::unique_ptr<Engine> field;
+            try {
+                field = makeEngine(engine_name, size, options);
+            } catch (const std::invalid_argument &e) {
+                std::fprintf(stderr, "%s\n", e.what());
+                return 1;
+            }
+            std::string name = pattern;
+            if (name == "soup") {
+                field->populateRandom(soup);
+            } else if (name == "gun") {
+                placeGliderGun(*field, size / 8, size / 8);
+            }
+            printResult(engine_name, name, size,
+                runGenerations(*field, generations, BENCH_MIN_SECONDS));
+            std::fflush(stdout);
+        }
+    }
+    if (engine_name == "swar") {
+        tuneTimeBlock(sizes[2], options, soup, BENCH_MIN_SECONDS, true);
+    }
+    return 0;
+}
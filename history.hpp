@@ -0,0 +1,325 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+#include "engine.hpp"
+
+// deltas between two keyframes, fewer restore faster and keep more bytes
+#define HISTORY_KEYFRAME_EVERY 64
+// the whole board is read every generation, larger ones keep no history
+#define HISTORY_SIZE_MAX 16384
+
+// a deflated board (a keyframe) or the deflated changed 64x64 tiles of one
+// (a delta), each as its tile index and 64 rows xor the frame before
+struct HistoryFrame {
+    uint64_t generation;
+    std::vector<uint8_t> data;
+    // no edits since the frame before, so the generations skipped in
+    // between can be stepped to from it
+    bool steps_only;
+};
+
+// a keyframe and the deltas after it, dropped as a whole when the oldest
+struct HistorySegment {
+    std::vector<HistoryFrame> frames;
+    size_t bytes = 0;
+};
+
+// the last generations of the board within a budget of bytes; the calling
+// thread only reads the board, diffing and deflating happen on a thread of
+// its own. while a board waits there the newer ones are not read at all, a
+// delta then spans several generations and the ones in between have to be
+// stepped to from the frame before
+class History {
+    size_t budget;
+    std::deque<HistorySegment> segments;
+    size_t bytes = 0;
+    // of the recorded frames, and the board of the last one
+    size_t n = 0;
+    std::vector<uint64_t> last;
+
+    std::mutex mutex;
+    std::condition_variable cv, idle_cv;
+    std::vector<uint64_t> pending, spare;
+    size_t pending_n = 0;
+    uint64_t pending_generation = 0;
+    bool has_pending = false;
+    // edits up to the waiting board, and since it when boards were not read
+    bool pending_edited = false, unread_edited = false;
+    bool busy = false;
+    bool stopping = false;
+    std::thread thread;
+
+    static std::vector<uint8_t> deflated(const void *src, size_t len) {
+        uLongf out_len = compressBound(len);
+        std::vector<uint8_t> out(out_len);
+        compress2(out.data(), &out_len, (const Bytef *)src, len, Z_BEST_SPEED);
+        out.resize(out_len);
+        return out;
+    }
+
+    static bool inflated(const std::vector<uint8_t> &src, void *dst, size_t len) {
+        uLongf out_len = len;
+        return uncompress((Bytef *)dst, &out_len, src.data(), src.size()) == Z_OK && out_len == len;
+    }
+
+    size_t stride() const {
+        return (n + 63) / 64;
+    }
+
+    // tile index and its rows that changed from last to board, as 64 words
+    std::vector<uint64_t> changedTiles(const std::vector<uint64_t> &board) const {
+        std::vector<uint64_t> tiles;
+        size_t words = stride();
+        for (size_t ty = 0; ty * 64 < n; ++ty) {
+            size_t rows = std::min<size_t>(64, n - ty * 64);
+            for (size_t tx = 0; tx < words; ++tx) {
+                uint64_t any = 0;
+                for (size_t r = 0; r < rows; ++r) {
+                    size_t i = (ty * 64 + r) * words + tx;
+                    any |= board[i] ^ last[i];
+                }
+                if (!any) {
+                    continue;
+                }
+                tiles.push_back(ty * words + tx);
+                for (size_t r = 0; r < 64; ++r) {
+                    size_t i = (ty * 64 + r) * words + tx;
+                    tiles.push_back(r < rows ? board[i] ^ last[i] : 0);
+                }
+            }
+        }
+        return tiles;
+    }
+
+    // applies a delta decoded by changedTiles
+    void applyTiles(const std::vector<uint64_t> &tiles, std::vector<uint64_t> &board) const {
+        size_t words = stride();
+        for (size_t k = 0; k < tiles.size(); k += 65) {
+            size_t ty = tiles[k] / words, tx = tiles[k] % words;
+            size_t rows = std::min<size_t>(64, n - ty * 64);
+            for (size_t r = 0; r < rows; ++r) {
+                board[(ty * 64 + r) * words + tx] ^= tiles[k + 1 + r];
+            }
+        }
+    }
+
+    // the board at a frame of a segment, from its keyframe
+    bool decode(const HistorySegment &segment, size_t frame, std::vector<uint64_t> &board) const {
+        board.assign(stride() * n, 0);
+        if (!inflated(segment.frames[0].data, board.data(), board.size() * 8)) {
+            return false;
+        }
+        std::vector<uint64_t> tiles;
+        for (size_t f = 1; f <= frame; ++f) {
+            const std::vector<uint8_t> &data = segment.frames[f].data;
+            if (data.empty()) {
+                continue;
+            }
+            // deflate does not keep the length, at most every tile changed
+            tiles.resize(stride() * ((n + 63) / 64) * 65);
+            uLongf len = tiles.size() * 8;
+            if (uncompress((Bytef *)tiles.data(), &len, data.data(), data.size()) != Z_OK) {
+                return false;
+            }
+            tiles.resize(len / 8);
+            applyTiles(tiles, board);
+        }
+        return true;
+    }
+
+    void append(HistoryFrame frame, bool keyframe) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (keyframe) {
+            segments.emplace_back();
+        }
+        segments.back().bytes += frame.data.size();
+        bytes += frame.data.size();
+        segments.back().frames.push_back(std::move(frame));
+        while (bytes > budget && segments.size() > 1) {
+            bytes -= segments.front().bytes;
+            segments.pop_front();
+        }
+    }
+
+    void record(std::vector<uint64_t> &board, size_t size, uint64_t generation, bool steps_only) {
+        bool keyframe = false;
+        if (size != n || (!segments.empty() && generation < segments.back().frames.back().generation)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            segments.clear();
+            bytes = 0;
+            n = size;
+        }
+        if (segments.empty()) {
+            keyframe = true;
+        } else {
+            const HistorySegment &segment = segments.back();
+            // a segment takes at most half the budget, so one older is kept
+            keyframe |= segment.frames.size() >= HISTORY_KEYFRAME_EVERY || segment.bytes > budget / 2;
+        }
+        HistoryFrame frame = {generation, {}, steps_only};
+        if (keyframe) {
+            frame.data = deflated(board.data(), board.size() * 8);
+        } else {
+            std::vector<uint64_t> tiles = changedTiles(board);
+            // an edit that changed nothing or a command that did not touch the board
+            if (tiles.empty() && generation == segments.back().frames.back().generation) {
+                std::swap(last, board);
+                return;
+            }
+            if (!tiles.empty()) {
+                frame.data = deflated(tiles.data(), tiles.size() * 8);
+            }
+        }
+        append(std::move(frame), keyframe);
+        std::swap(last, board);
+    }
+
+    void run() {
+        for (;;) {
+            std::vector<uint64_t> board;
+            size_t size;
+            uint64_t generation;
+            bool steps_only;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return stopping || has_pending; });
+                if (!has_pending) {
+                    return;
+                }
+                board.swap(pending);
+                size = pending_n;
+                generation = pending_generation;
+                steps_only = !pending_edited;
+                has_pending = pending_edited = false;
+                busy = true;
+            }
+            record(board, size, generation, steps_only);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                // the board of the frame before, to read the next one into
+                spare.swap(board);
+                busy = false;
+            }
+            idle_cv.notify_all();
+        }
+    }
+
+public:
+    History(size_t budget) : budget(budget) {
+        thread = std::thread(&History::run, this);
+    }
+
+    ~History() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_one();
+        thread.join();
+    }
+
+    History(const History &) = delete;
+    History &operator=(const History &) = delete;
+
+    // only reads the board on the calling thread, and only when the last
+    // one was taken; edited when more than steps changed it since the last update
+    void update(const Engine &field, uint64_t generation, bool edited) {
+        size_t size = field.size();
+        // what left the window of an unbounded board could not be put back
+        if (size > HISTORY_SIZE_MAX || !field.bounded()) {
+            return;
+        }
+        std::vector<uint64_t> board;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (has_pending) {
+                unread_edited |= edited;
+                return;
+            }
+            board.swap(spare);
+        }
+        size_t words = (size + 63) / 64;
+        board.assign(words * size, 0);
+        field.readRegion(0, 0, size, size, board.data(), words);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.swap(board);
+            pending_edited = unread_edited || edited;
+            unread_edited = false;
+            pending_n = size;
+            pending_generation = generation;
+            has_pending = true;
+        }
+        cv.notify_one();
+    }
+
+    // after a load the generations before belong to another board
+    void clear() {
+        std::unique_lock<std::mutex> lock(mutex);
+        has_pending = pending_edited = unread_edited = false;
+        idle_cv.wait(lock, [&] { return !busy; });
+        segments.clear();
+        bytes = 0;
+        n = 0;
+    }
+
+    // of the board the frames are of, 0 before the first
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return n;
+    }
+
+    // the board of the newest frame at or before generation, or of the
+    // oldest one kept; the frames after it are dropped as the board goes on
+    // from there. steppable is set when generation can be reached from it
+    // by steps alone, false with no frames
+    bool restore(uint64_t generation, std::vector<uint64_t> &board, uint64_t &restored,
+            bool &steppable)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        // the boards after the last frame were steps only if none was an edit
+        steppable = !pending_edited && !unread_edited;
+        has_pending = pending_edited = unread_edited = false;
+        idle_cv.wait(lock, [&] { return !busy; });
+        if (segments.empty()) {
+            return false;
+        }
+        size_t s = segments.size() - 1;
+        while (s > 0 && segments[s].frames[0].generation > generation) {
+            --s;
+        }
+        HistorySegment &segment = segments[s];
+        size_t f = segment.frames.size() - 1;
+        while (f > 0 && segment.frames[f].generation > generation) {
+            --f;
+        }
+        if (!decode(segment, f, board)) {
+            return false;
+        }
+        if (f + 1 < segment.frames.size()) {
+            steppable = segment.frames[f + 1].steps_only;
+        } else if (s + 1 < segments.size()) {
+            steppable = segments[s + 1].frames[0].steps_only;
+        }
+        restored = segment.frames[f].generation;
+        steppable &= restored < generation;
+        segments.resize(s + 1);
+        segment.frames.resize(f + 1);
+        segment.bytes = 0;
+        for (const HistoryFrame &frame : segment.frames) {
+            segment.bytes += frame.data.size();
+        }
+        bytes = 0;
+        for (const HistorySegment &kept : segments) {
+            bytes += kept.bytes;
+        }
+        last = board;
+        return true;
+    }
+};
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "rule.hpp"
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+// rules as policies: next() sets out from the cells b and their neighbour
+// counts s0 + 2 * s1 + 4 * (t1 + k1), one cell per bit
+
+// B3/S23 straight from the adder outputs
+struct LifeRule {
+    template <typename T>
+    [[gnu::always_inline]] static void next(T &out, const Rule &, const T &b,
+            const T &s0, const T &s1, const T &t1, const T &k1)
+    {
+        out = s1 & ~(t1 | k1) & (s0 | b);
+    }
+};
+
+// cells with k neighbours, from the bits c0..c3 of the count
+template <typename T>
+[[gnu::always_inline]] inline void countIs(T &out, int k,
+        const T &c0, const T &c1, const T &c2, const T &c3)
+{
+    out = (k & 1 ? c0 : ~c0) & (k & 2 ? c1 : ~c1) & (k & 4 ? c2 : ~c2) & (k & 8 ? c3 : ~c3);
+}
+
+// masks known at compile time, counts in neither set drop out
+template <uint16_t B, uint16_t S>
+struct FixedRule {
+    template <typename T>
+    [[gnu::always_inline]] static void next(T &out, const Rule &, const T &b,
+            const T &s0, const T &s1, const T &t1, const T &k1)
+    {
+        T c2 = t1 ^ k1, c3 = t1 & k1, eq;
+        out = b & 0;
+        for (int k = 0; k <= 8; ++k) {
+            bool born = (B >> k) & 1, survives = (S >> k) & 1;
+            if (born || survives) {
+                countIs(eq, k, s0, s1, c2, c3);
+                out |= born && survives ? eq : born ? eq & ~b : eq & b;
+            }
+        }
+    }
+};
+
+// any other rule, looked up from the masks at run time
+struct TableRule {
+    template <typename T>
+    [[gnu::always_inline]] static void next(T &out, const Rule &rule, const T &b,
+            const T &s0, const T &s1, const T &t1, const T &k1)
+    {
+        T c2 = t1 ^ k1, c3 = t1 & k1, eq;
+        out = b & 0;
+        for (int k = 0; k <= 8; ++k) {
+            uint64_t born = -(uint64_t)((rule.birth >> k) & 1);
+            uint64_t survives = -(uint64_t)((rule.survive >> k) & 1);
+            countIs(eq, k, s0, s1, c2, c3);
+            out |= ((~b & born) | (b & survives)) & eq;
+        }
+    }
+};
+
+// sum of the eight neighbours by half/full adders, one cell per bit,
+// T is uint64_t or a vector of them
+template <typename R, typename T>
+[[gnu::always_inline]] inline void lifeWord(T &out, const Rule &rule,
+    const T &aw, const T &a, const T &ae,
+    const T &bw, const T &b, const T &be,
+    const T &cw, const T &c, const T &ce)
+{
+    T a0 = aw ^ a ^ ae, a1 = (aw & a) | (ae & (aw ^ a));
+    T b0 = bw ^ be, b1 = bw & be;
+    T c0 = cw ^ c ^ ce, c1 = (cw & c) | (ce & (cw ^ c));
+    T s0 = a0 ^ b0 ^ c0, k0 = (a0 & b0) | (c0 & (a0 ^ b0));
+    T t0 = a1 ^ b1 ^ c1, t1 = (a1 & b1) | (c1 & (a1 ^ b1));
+    T s1 = t0 ^ k0, k1 = t0 & k0;
+    R::next(out, rule, b, s0, s1, t1, k1);
+}
+
+// words [begin, end) of the row, a, b, c are the rows above, at and below
+template <typename R>
+[[gnu::always_inline]] inline void lifeRowRange(
+        const uint64_t *a, const uint64_t *b, const uint64_t *c,
+        uint64_t *out, size_t words, size_t begin, size_t end, const Rule &rule)
+{
+    for (size_t i = begin; i < end; ++i) {
+        uint64_t a_prev = i ? a[i - 1] : 0, a_next = i + 1 < words ? a[i + 1] : 0;
+        uint64_t b_prev = i ? b[i - 1] : 0, b_next = i + 1 < words ? b[i + 1] : 0;
+        uint64_t c_prev = i ? c[i - 1] : 0, c_next = i + 1 < words ? c[i + 1] : 0;
+        lifeWord<R>(out[i], rule,
+            (a[i] << 1) | (a_prev >> 63), a[i], (a[i] >> 1) | (a_next << 63),
+            (b[i] << 1) | (b_prev >> 63), b[i], (b[i] >> 1) | (b_next << 63),
+            (c[i] << 1) | (c_prev >> 63), c[i], (c[i] >> 1) | (c_next << 63));
+    }
+}
+
+// recomputes the first and last word of a row of n cells whose ends wrap
+// around, the row kernels treat the cells past them as dead
+inline void lifeRowWrap(const uint64_t *a, const uint64_t *b, const uint64_t *c,
+        uint64_t *out, size_t words, size_t n, const Rule &rule)
+{
+    unsigned top = (n - 1) & 63;
+    auto west = [&](const uint64_t *r, size_t i) {
+        return (r[i] << 1) | (i ? r[i - 1] >> 63 : (r[words - 1] >> top) & 1);
+    };
+    auto east = [&](const uint64_t *r, size_t i) {
+        return (r[i] >> 1) | (i + 1 < words ? r[i + 1] << 63 : (r[0] & 1) << top);
+    };
+    for (size_t i : {(size_t)0, words - 1}) {
+        lifeWord<TableRule>(out[i], rule,
+            west(a, i), a[i], east(a, i),
+            west(b, i), b[i], east(b, i),
+            west(c, i), c[i], east(c, i));
+    }
+}
+
+template <typename R, typename V>
+[[gnu::always_inline]] inline void lifeRowVector(
+        const uint64_t *a, const uint64_t *b, const uint64_t *c,
+        uint64_t *out, size_t words, const Rule &rule)
+{
+    constexpr size_t lanes = sizeof(V) / sizeof(uint64_t);
+    if (words < lanes + 2) {
+        lifeRowRange<R>(a, b, c, out, words, 0, words, rule);
+        return;
+    }
+    lifeRowRange<R>(a, b, c, out, words, 0, 1, rule);
+    size_t i;
+    // the vector body reads words i - 1 to i + lanes
+    for (i = 1; i + lanes < words; i += lanes) {
+        V row[3][3];
+        const uint64_t *in[3] = {a, b, c};
+        for (int r = 0; r < 3; ++r) {
+            V prev, next;
+            std::memcpy(&prev, in[r] + i - 1, sizeof(V));
+            std::memcpy(&row[r][1], in[r] + i, sizeof(V));
+            std::memcpy(&next, in[r] + i + 1, sizeof(V));
+            row[r][0] = (row[r][1] << 1) | (prev >> 63);
+            row[r][2] = (row[r][1] >> 1) | (next << 63);
+        }
+        V res;
+        lifeWord<R>(res, rule,
+            row[0][0], row[0][1], row[0][2],
+            row[1][0], row[1][1], row[1][2],
+            row[2][0], row[2][1], row[2][2]);
+        std::memcpy(out + i, &res, sizeof(V));
+    }
+    lifeRowRange<R>(a, b, c, out, words, i, words, rule);
+}
+
+typedef void (*LifeRowFn)(const uint64_t *a, const uint64_t *b, const uint64_t *c,
+        uint64_t *out, size_t words, const Rule &rule);
+
+template <typename R>
+inline void lifeRowScalar(const uint64_t *a, const uint64_t *b, const uint64_t *c,
+        uint64_t *out, size_t words, const Rule &rule)
+{
+    lifeRowRange<R>(a, b, c, out, words, 0, words, rule);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+typedef uint64_t u64x4 __attribute__((vector_size(32)));
+typedef uint64_t u64x8 __attribute__((vector_size(64)));
+
+template <typename R>
+__attribute__((target("avx2")))
+inline void lifeRowAVX2(const uint64_t *a, const uint64_t *b, const uint64_t *c,
+        uint64_t *out, size_t words, const Rule &rule)
+{
+    lifeRowVector<R, u64x4>(a, b, c, out, words, rule);
+}
+
+template <typename R>
+__attribute__((target("avx512f")))
+inline void lifeRowAVX512(const uint64_t *a, const uint64_t *b, const uint64_t *c,
+        uint64_t *out, size_t words, const Rule &rule)
+{
+    lifeRowVector<R, u64x8>(a, b, c, out, words, rule);
+}
+#elif defined(__aarch64__)
+typedef uint64_t u64x2 __attribute__((vector_size(16)));
+
+template <typename R>
+inline void lifeRowNEON(const uint64_t *a, const uint64_t *b, const uint64_t *c,
+        uint64_t *out, size_t words, const Rule &rule)
+{
+    lifeRowVector<R, u64x2>(a, b, c, out, words, rule);
+}
+#endif
+
+enum class LifeRowIsa { Scalar, AVX2, AVX512, NEON };
+
+struct LifeRowKernel {
+    const char *name;
+    LifeRowIsa isa;
+};
+
+// picked once from what the cpu supports
+inline LifeRowKernel detectLifeRowKernel() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return {"avx512", LifeRowIsa::AVX512};
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return {"avx2", LifeRowIsa::AVX2};
+    }
+#elif defined(__aarch64__)
+#if defined(__linux__)
+    if (getauxval(AT_HWCAP) & HWCAP_ASIMD) {
+        return {"neon", LifeRowIsa::NEON};
+    }
+#else
+    return {"neon", LifeRowIsa::NEON};
+#endif
+#endif
+    return {"scalar", LifeRowIsa::Scalar};
+}
+
+inline const LifeRowKernel &lifeRowKernel() {
+    static const LifeRowKernel kernel = detectLifeRowKernel();
+    return kernel;
+}
+
+// rules with their own instantiations, everything else goes through TableRule
+#define HIGHLIFE_RULE_B (1 << 3 | 1 << 6)
+#define SEEDS_RULE_B (1 << 2)
+#define DAY_NIGHT_RULE_B (1 << 3 | 1 << 6 | 1 << 7 | 1 << 8)
+#define DAY_NIGHT_RULE_S (1 << 3 | 1 << 4 | 1 << 6 | 1 << 7 | 1 << 8)
+#define LIFE_WITHOUT_DEATH_RULE_S 0x1ff
+
+// calls f.template operator()<R>() with the policy for the rule
+template <typename F>
+inline auto withRulePolicy(const Rule &rule, F &&f) {
+    if (rule == LIFE_RULE) {
+        return f.template operator()<LifeRule>();
+    } else if (rule == Rule{HIGHLIFE_RULE_B, LIFE_SURVIVE}) {
+        return f.template operator()<FixedRule<HIGHLIFE_RULE_B, LIFE_SURVIVE>>();
+    } else if (rule == Rule{SEEDS_RULE_B, 0}) {
+        return f.template operator()<FixedRule<SEEDS_RULE_B, 0>>();
+    } else if (rule == Rule{DAY_NIGHT_RULE_B, DAY_NIGHT_RULE_S}) {
+        return f.template operator()<FixedRule<DAY_NIGHT_RULE_B, DAY_NIGHT_RULE_S>>();
+    } else if (rule == Rule{LIFE_BIRTH, LIFE_WITHOUT_DEATH_RULE_S}) {
+        return f.template operator()<FixedRule<LIFE_BIRTH, LIFE_WITHOUT_DEATH_RULE_S>>();
+    }
+    return f.template operator()<TableRule>();
+}
+
+inline LifeRowFn lifeRowFn(const Rule &rule) {
+    return withRulePolicy(rule, []<typename R>() -> LifeRowFn {
+        switch (lifeRowKernel().isa) {
+#if defined(__x86_64__) || defined(__i386__)
+        case LifeRowIsa::AVX512:
+            return lifeRowAVX512<R>;
+        case LifeRowIsa::AVX2:
+            return lifeRowAVX2<R>;
+#elif defined(__aarch64__)
+        case LifeRowIsa::NEON:
+            return lifeRowNEON<R>;
+#endif
+        default:
+            return lifeRowScalar<R>;
+        }
+    });
+}
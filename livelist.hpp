@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "engine.hpp"
+#include "gamefield.hpp"
+
+// neighbour count in the low bits of a cell, then its state and whether the
+// current step has listed it
+#define LIST_COUNT_MASK 0x0f
+#define LIST_ALIVE 0x10
+#define LIST_TOUCHED 0x20
+
+// the live cells as a list of Z-curve indices; a step adds one to the count
+// of every neighbour of a live cell and decides the cells it touched, so it
+// costs time in proportion to the population rather than the board
+class LiveListField : public Engine {
+    static const uint32_t MASK_X = 0b01010101010101010101010101010101;
+    static const uint32_t MASK_Y = 0b10101010101010101010101010101010;
+
+    size_t n;
+    uint32_t size_x, size_y;
+    // neighbour coordinates are masked by these, on a torus they wrap
+    uint32_t wrap_x = MASK_X, wrap_y = MASK_Y;
+    Rule life_rule;
+    Topology edges;
+    std::vector<uint8_t> cells;
+    std::vector<uint32_t> live, touched, next;
+    TrackedHash board_hash;
+
+    static uint64_t cellKey(uint32_t idx) {
+        uint16_t x, y;
+        deinterleaveXY(idx, x, y);
+        return zobristKey(x, y);
+    }
+
+    void touch(uint32_t idx) {
+        uint8_t &c = cells[idx];
+        if (!(c & LIST_TOUCHED)) {
+            c |= LIST_TOUCHED;
+            touched.push_back(idx);
+        }
+    }
+
+    void setCell(uint32_t idx) {
+        if (!(cells[idx] & LIST_ALIVE)) {
+            cells[idx] |= LIST_ALIVE;
+            live.push_back(idx);
+        }
+    }
+
+public:
+    LiveListField(size_t size, const EngineOptions &options = {}) :
+        n(size), life_rule(options.rule), edges(options.topology)
+    {
+        checkRule(options.rule);
+        if (size == 0 || (size & (size - 1))) {
+            throw std::invalid_argument("size needs to be power of 2");
+        }
+        // one byte of counts per cell
+        if (size > 16384) {
+            throw std::invalid_argument("size >16384 not supported");
+        }
+        size_x = interleaveXY(size, 0);
+        size_y = size_x << 1;
+        if (edges == Topology::Torus) {
+            wrap_x = (size_x - 1) & MASK_X;
+            wrap_y = (size_y - 1) & MASK_Y;
+        }
+        cells.assign(size * size, 0);
+    }
+
+    size_t size() const override {
+        return n;
+    }
+
+    Rule rule() const override {
+        return life_rule;
+    }
+
+    Topology topology() const override {
+        return edges;
+    }
+
+    bool get(int64_t x, int64_t y) const override {
+        return cells[interleaveXY(x, y)] & LIST_ALIVE;
+    }
+
+    // removing a cell looks for it in the list
+    void toggle(int64_t x, int64_t y) override {
+        uint32_t idx = interleaveXY(x, y);
+        if (cells[idx] & LIST_ALIVE) {
+            cells[idx] &= ~LIST_ALIVE;
+            live.erase(std::find(live.begin(), live.end(), idx));
+        } else {
+            setCell(idx);
+        }
+        board_hash.flip(zobristKey(x, y));
+    }
+
+    void clear() override {
+        for (uint32_t idx : live) {
+            cells[idx] = 0;
+        }
+        live.clear();
+        board_hash.invalidate();
+    }
+
+    void populateRandom(const SoupOptions &soup) override {
+        clear();
+        for (size_t y = 0; y < n; ++y) {
+            for (size_t j = 0; j * 64 < n; ++j) {
+                uint64_t bits = soupWord(soup, y, j, n);
+                while (bits) {
+                    setCell(interleaveXY(j * 64 + __builtin_ctzll(bits), y));
+                    bits &= bits - 1;
+                }
+            }
+        }
+    }
+
+    void setAlive(const uint32_t *idxs, size_t len) override {
+        for (size_t i = 0; i < len; ++i) {
+            if (idxs[i] < cells.size()) {
+                setCell(idxs[i]);
+            }
+        }
+        board_hash.invalidate();
+    }
+
+    void getAlive(std::vector<uint32_t> &idxs) const override {
+        size_t first = idxs.size();
+        idxs.insert(idxs.end(), live.begin(), live.end());
+        std::sort(idxs.begin() + first, idxs.end());
+    }
+
+    uint64_t population() const override {
+        return live.size();
+    }
+
+    uint64_t cellsVisited() const override {
+        return touched.size();
+    }
+
+    // from the list when it is shorter than the region
+    void readRegion(int64_t x0, int64_t y0, size_t w, size_t h,
+            uint64_t *bits, size_t stride) const override
+    {
+        if (live.size() >= w * h) {
+            Engine::readRegion(x0, y0, w, h, bits, stride);
+            return;
+        }
+        for (uint32_t idx : live) {
+            uint16_t x, y;
+            deinterleaveXY(idx, x, y);
+            uint64_t dx = x - x0, dy = y - y0;
+            if (dx < w && dy < h) {
+                bits[dy * stride + (dx >> 6)] |= 1ull << (dx & 63);
+            }
+        }
+    }
+
+    uint64_t hash() const override {
+        return board_hash.get([&] {
+            uint64_t h = 0;
+            for (uint32_t idx : live) {
+                h ^= cellKey(idx);
+            }
+            return h;
+        });
+    }
+
+    std::unique_ptr<Engine> clone() const override {
+        EngineOptions options;
+        options.rule = life_rule;
+        options.topology = edges;
+        auto copy = std::make_unique<LiveListField>(n, options);
+        copy->setAlive(live.data(), live.size());
+        return copy;
+    }
+
+    // only the touched cells are decided and reset, everything else is dead
+    // with a zero count already
+    void step() override {
+        touched.clear();
+        for (uint32_t idx : live) {
+            // a live cell without neighbours is decided too
+            touch(idx);
+            uint32_t x = idx & MASK_X, y = idx & MASK_Y;
+            uint32_t xs[3] = {(x - 1) & wrap_x, x, ((idx | MASK_Y) + 1) & wrap_x};
+            uint32_t ys[3] = {(y - 1) & wrap_y, y, ((idx | MASK_X) + 1) & wrap_y};
+            for (int dy = 0; dy < 3; ++dy) {
+                if (ys[dy] >= size_y) {
+                    continue;
+                }
+                for (int dx = 0; dx < 3; ++dx) {
+                    if (xs[dx] >= size_x || (dx == 1 && dy == 1)) {
+                        continue;
+                    }
+                    uint32_t nb = xs[dx] | ys[dy];
+                    touch(nb);
+                    ++cells[nb];
+                }
+            }
+        }
+        next.clear();
+        uint64_t keys = 0;
+        bool tracking = board_hash.tracking();
+        for (uint32_t idx : touched) {
+            uint8_t c = cells[idx];
+            bool alive = c & LIST_ALIVE;
+            uint16_t mask = alive ? life_rule.survive : life_rule.birth;
+            bool now = (mask >> (c & LIST_COUNT_MASK)) & 1;
+            cells[idx] = now ? LIST_ALIVE : 0;
+            if (now) {
+                next.push_back(idx);
+            }
+            if (tracking && now != alive) {
+                keys ^= cellKey(idx);
+            }
+        }
+        std::swap(live, next);
+        board_hash.flip(keys);
+    }
+};
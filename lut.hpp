@@ -0,0 +1,321 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "engine.hpp"
+#include "gamefield.hpp"
+#include "pages.hpp"
+#include "threadpool.hpp"
+
+#define LUT_BLOCK 4
+#define LUT_TABLE_SIZE (1 << 16)
+
+// next state of the centre 2x2 of every 4x4 neighbourhood, cell (x, y) of
+// the neighbourhood is bit y * 4 + x, the centre comes back as bits
+// (1, 1), (2, 1), (1, 2), (2, 2)
+inline std::shared_ptr<const std::vector<uint8_t>> makeLutTable(const Rule &rule) {
+    auto table = std::make_shared<std::vector<uint8_t>>(LUT_TABLE_SIZE);
+    for (uint32_t bits = 0; bits < LUT_TABLE_SIZE; ++bits) {
+        uint8_t res = 0;
+        for (int i = 0; i < 4; ++i) {
+            int cx = 1 + (i & 1), cy = 1 + (i >> 1);
+            int count = 0;
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    if (dx || dy) {
+                        count += (bits >> ((cy + dy) * 4 + cx + dx)) & 1;
+                    }
+                }
+            }
+            bool self = (bits >> (cy * 4 + cx)) & 1;
+            uint16_t mask = self ? rule.survive : rule.birth;
+            res |= ((mask >> count) & 1) << i;
+        }
+        (*table)[bits] = res;
+    }
+    return table;
+}
+
+// 4x4 blocks of cells in 16 bit words, bit (y % 4) * 4 + (x % 4), stepped by
+// four table lookups per block into a second buffer
+class LutField : public Engine {
+    size_t n, side;
+    Rule life_rule;
+    Topology edges;
+    ThreadPool *pool;
+    std::shared_ptr<const std::vector<uint8_t>> table;
+    PageVector<uint16_t> blocks, next;
+    // a dead row of blocks past the top and bottom
+    std::vector<uint16_t> zero;
+    TrackedHash board_hash;
+
+    // keys of the cells set in a block
+    static uint64_t blockKeys(uint16_t b, int64_t x0, int64_t y0) {
+        uint64_t keys = 0;
+        for (int r = 0; r < LUT_BLOCK; ++r) {
+            keys ^= zobristWord((b >> (r * 4)) & 0xf, x0, y0 + r);
+        }
+        return keys;
+    }
+
+    // cells x = -1..4 of row r of the centre block as bits 0..5
+    static uint64_t windowRow(uint16_t w, uint16_t c, uint16_t e, int r) {
+        return ((w >> (r * 4 + 3)) & 1) | (((c >> (r * 4)) & 0xf) << 1)
+            | (((uint64_t)(e >> (r * 4)) & 1) << 5);
+    }
+
+    // the block m with its eight neighbours, a above and c below
+    uint16_t stepBlock(uint16_t aw, uint16_t am, uint16_t ae, uint16_t bw, uint16_t bm,
+            uint16_t be, uint16_t cw, uint16_t cm, uint16_t ce) const
+    {
+        // the 6x6 cells around the block, row dy + 1 of 8 bits each
+        uint64_t window = windowRow(aw, am, ae, 3)
+            | windowRow(bw, bm, be, 0) << 8 | windowRow(bw, bm, be, 1) << 16
+            | windowRow(bw, bm, be, 2) << 24 | windowRow(bw, bm, be, 3) << 32
+            | windowRow(cw, cm, ce, 0) << 40;
+        if (!window) {
+            return 0;
+        }
+        const uint8_t *lut = table->data();
+        uint16_t out = 0;
+        for (int oy = 0; oy < LUT_BLOCK; oy += 2) {
+            for (int ox = 0; ox < LUT_BLOCK; ox += 2) {
+                uint64_t rows = window >> (oy * 8 + ox);
+                uint32_t idx = (rows & 0xf) | ((rows >> 8) & 0xf) << 4
+                    | ((rows >> 16) & 0xf) << 8 | ((rows >> 24) & 0xf) << 12;
+                uint16_t res = lut[idx];
+                out |= (res & 3) << (oy * 4 + ox) | (res >> 2) << ((oy + 1) * 4 + ox);
+            }
+        }
+        return out;
+    }
+
+    // only the first and last block of a row look past its ends, the rows
+    // past the top and bottom are dead or wrap around; returns the keys of
+    // the flipped cells when the hash is tracked
+    uint64_t stepRow(size_t by) {
+        bool torus = edges == Topology::Torus;
+        const uint16_t *b = &blocks[by * side];
+        const uint16_t *a = by ? b - side : torus ? &blocks[(side - 1) * side] : zero.data();
+        const uint16_t *c = by + 1 < side ? b + side : torus ? &blocks[0] : zero.data();
+        uint16_t *out = &next[by * side];
+        size_t last = side - 1;
+        uint16_t aw = torus ? a[last] : 0, bw = torus ? b[last] : 0, cw = torus ? c[last] : 0;
+        for (size_t bx = 0; bx < last; ++bx) {
+            out[bx] = stepBlock(aw, a[bx], a[bx + 1], bw, b[bx], b[bx + 1], cw, c[bx], c[bx + 1]);
+            aw = a[bx];
+            bw = b[bx];
+            cw = c[bx];
+        }
+        out[last] = stepBlock(aw, a[last], torus ? a[0] : 0, bw, b[last], torus ? b[0] : 0,
+            cw, c[last], torus ? c[0] : 0);
+        uint64_t keys = 0;
+        if (board_hash.tracking()) {
+            for (size_t bx = 0; bx < side; ++bx) {
+                if (b[bx] != out[bx]) {
+                    keys ^= blockKeys(b[bx] ^ out[bx], bx * LUT_BLOCK, by * LUT_BLOCK);
+                }
+            }
+        }
+        return keys;
+    }
+
+    uint16_t &block(int64_t x, int64_t y) {
+        return blocks[(y >> 2) * side + (x >> 2)];
+    }
+
+    static uint16_t bit(int64_t x, int64_t y) {
+        return 1 << ((y & 3) * 4 + (x & 3));
+    }
+
+public:
+    LutField(size_t size, const EngineOptions &options = {}) :
+        n(size), life_rule(options.rule), edges(options.topology), pool(options.pool)
+    {
+        checkRule(options.rule);
+        if (size < LUT_BLOCK || (size & (size - 1))) {
+            throw std::invalid_argument("size needs to be power of 2 and at least 4");
+        }
+        if (size > 65536) {
+            throw std::invalid_argument("size >65536 not supported");
+        }
+        side = size / LUT_BLOCK;
+        table = makeLutTable(life_rule);
+        blocks.assign(side * side, 0);
+        next.assign(side * side, 0);
+        zero.assign(side, 0);
+    }
+
+    size_t size() const override {
+        return n;
+    }
+
+    Rule rule() const override {
+        return life_rule;
+    }
+
+    Topology topology() const override {
+        return edges;
+    }
+
+    bool get(int64_t x, int64_t y) const override {
+        return blocks[(y >> 2) * side + (x >> 2)] & bit(x, y);
+    }
+
+    void toggle(int64_t x, int64_t y) override {
+        block(x, y) ^= bit(x, y);
+        board_hash.flip(zobristKey(x, y));
+    }
+
+    void clear() override {
+        std::fill(blocks.begin(), blocks.end(), 0);
+        board_hash.invalidate();
+    }
+
+    // rows of blocks in parallel, four soup words make 16 blocks
+    void populateRandom(const SoupOptions &soup) override {
+        auto fill = [&](size_t by) {
+            for (size_t bx = 0; bx < side; bx += 16) {
+                uint64_t rows[LUT_BLOCK];
+                for (int r = 0; r < LUT_BLOCK; ++r) {
+                    rows[r] = soupWord(soup, by * LUT_BLOCK + r, bx / 16, n);
+                }
+                for (size_t k = 0; k < 16 && bx + k < side; ++k) {
+                    uint16_t b = 0;
+                    for (int r = 0; r < LUT_BLOCK; ++r) {
+                        b |= ((rows[r] >> (k * 4)) & 0xf) << (r * 4);
+                    }
+                    blocks[by * side + bx + k] = b;
+                }
+            }
+        };
+        if (pool) {
+            pool->parallelFor(side, fill);
+        } else {
+            for (size_t by = 0; by < side; ++by) {
+                fill(by);
+            }
+        }
+        board_hash.invalidate();
+    }
+
+    void setAlive(const uint32_t *idxs, size_t len) override {
+        for (size_t i = 0; i < len; ++i) {
+            uint16_t x, y;
+            deinterleaveXY(idxs[i], x, y);
+            if (x < n && y < n) {
+                block(x, y) |= bit(x, y);
+            }
+        }
+        board_hash.invalidate();
+    }
+
+    void getAlive(std::vector<uint32_t> &idxs) const override {
+        size_t first = idxs.size();
+        for (size_t i = 0; i < side * side; ++i) {
+            uint32_t b = blocks[i];
+            size_t x0 = (i % side) * LUT_BLOCK, y0 = (i / side) * LUT_BLOCK;
+            while (b) {
+                int k = __builtin_ctz(b);
+                idxs.push_back(interleaveXY(x0 + (k & 3), y0 + (k >> 2)));
+                b &= b - 1;
+            }
+        }
+        std::sort(idxs.begin() + first, idxs.end());
+    }
+
+    uint64_t population() const override {
+        uint64_t count = 0;
+        for (uint16_t b : blocks) {
+            count += __builtin_popcount(b);
+        }
+        return count;
+    }
+
+    void readRegion(int64_t x0, int64_t y0, size_t w, size_t h,
+            uint64_t *bits, size_t stride) const override
+    {
+        int64_t xb = std::max<int64_t>(x0, 0), xe = std::min<int64_t>(x0 + w, n);
+        int64_t yb = std::max<int64_t>(y0, 0), ye = std::min<int64_t>(y0 + h, n);
+        for (int64_t y = yb; y < ye; ++y) {
+            uint64_t *row = &bits[(y - y0) * stride];
+            const uint16_t *b = &blocks[(y >> 2) * side];
+            int shift = (y & 3) * 4;
+            if (!(x0 & 3)) {
+                // the rows of blocks land on whole nibbles of the region
+                int64_t x = xb;
+                for (; x + 4 <= xe; x += 4) {
+                    int64_t dx = x - x0;
+                    row[dx >> 6] |= (uint64_t)((b[x >> 2] >> shift) & 0xf) << (dx & 63);
+                }
+                if (x < xe) {
+                    int64_t dx = x - x0;
+                    row[dx >> 6] |= (uint64_t)((b[x >> 2] >> shift) & ((1 << (xe - x)) - 1)) << (dx & 63);
+                }
+                continue;
+            }
+            // a row of a block is 4 cells, kept to the ones in the region
+            for (int64_t x = xb & ~3; x < xe; x += 4) {
+                uint64_t cells = (b[x >> 2] >> shift) & 0xf;
+                if (x < xb) {
+                    cells &= 0xf << (xb - x);
+                }
+                if (x + 4 > xe) {
+                    cells &= (1 << (xe - x)) - 1;
+                }
+                if (!cells) {
+                    continue;
+                }
+                int64_t dx = x - x0;
+                if (dx < 0) {
+                    row[0] |= cells >> -dx;
+                    continue;
+                }
+                row[dx >> 6] |= cells << (dx & 63);
+                // spanning two words of the region
+                if ((dx & 63) > 60 && cells >> (64 - (dx & 63))) {
+                    row[(dx >> 6) + 1] |= cells >> (64 - (dx & 63));
+                }
+            }
+        }
+    }
+
+    uint64_t hash() const override {
+        return board_hash.get([&] { return Engine::hash(); });
+    }
+
+    std::unique_ptr<Engine> clone() const override {
+        EngineOptions options;
+        options.rule = life_rule;
+        options.topology = edges;
+        auto copy = std::make_unique<LutField>(n, options);
+        copy->blocks = blocks;
+        return copy;
+    }
+
+    // block rows only read the current buffer, so they step in parallel
+    void step() override {
+        std::atomic<uint64_t> keys{0};
+        auto rows = [&](size_t begin, size_t end) {
+            uint64_t strip_keys = 0;
+            for (size_t by = begin; by < end; ++by) {
+                strip_keys ^= stepRow(by);
+            }
+            keys.fetch_xor(strip_keys, std::memory_order_relaxed);
+        };
+        if (pool && pool->size() > 1) {
+            size_t strips = std::min(side, pool->size() * 4);
+            size_t per = side / strips;
+            pool->parallelFor(strips, [&](size_t s) {
+                rows(s * per, s + 1 == strips ? side : (s + 1) * per);
+            });
+        } else {
+            rows(0, side);
+        }
+        std::swap(blocks, next);
+        board_hash.flip(keys);
+    }
+};
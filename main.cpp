@@ -1,11 +1,19 @@
 #include <SFML/Graphics.hpp>
 #include <iostream>
-#include <bitset>
-#include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
-#include <random>
 #include "nfd.h"
+#include "census.hpp"
+#include "cluster.hpp"
+#include "engine.hpp"
+#include "engines.hpp"
+#include "golfile.hpp"
+#include "headless.hpp"
+#include "microbench.hpp"
+#include "profile.hpp"
+#include "simulation.hpp"
+#include "threadpool.hpp"
 
 #define CELL_SIZE_INIT 25
 #define CELL_SIZE_MAX 100
@@ -14,6 +22,20 @@
 #define SCROLL_PPF 1
 #define FRAMES_PER_TICK_INIT 60
 #define DRAW_GRID_THRESHOLD 8
+#define LOD_LEVEL_MAX 10
+#define FIELD_SIZE_INIT 2048
+#define ENGINE_INIT "zcurve"
+#define HEADLESS_GENERATIONS_INIT 1000
+#define CENSUS_FIELD_SIZE_INIT 256
+#define HUD_TITLE_FRAMES 30
+// between polls while the window has nothing new to show
+#define IDLE_SLEEP_MS 10
+#define PROGRESS_BAR_HEIGHT 4
+#define MICROBENCH_DRAW_WIDTH 1920
+#define MICROBENCH_DRAW_HEIGHT 1080
+#define HISTORY_MB_INIT 64
+// generations Shift+Left goes back at once
+#define REWIND_SHIFT_GENERATIONS 100
 
 enum class FileDialogMode { Open, Save };
 
@@ -21,9 +43,9 @@ std::string file_dialog(FileDialogMode mode) {
     nfdchar_t *path = nullptr;
     nfdresult_t result;
     if (mode == FileDialogMode::Open) {
-        result = NFD_OpenDialog("gol", nullptr, &path);
+        result = NFD_OpenDialog("gol,rle,mc", nullptr, &path);
     } else {
-        result = NFD_SaveDialog("gol", nullptr, &path);
+        result = NFD_SaveDialog("gol,rle,mc", nullptr, &path);
     }
     if (result == NFD_ERROR) {
         std::cerr << "Error: " << NFD_GetError() << std::endl;
@@ -31,473 +53,728 @@ std::string file_dialog(FileDialogMode mode) {
     return result == NFD_OKAY ? path : "";
 }
 
-uint32_t delta_swap(uint32_t a, uint32_t mask, uint8_t shift) {
-    uint32_t b = ((a << shift) ^ a) & mask;
-    a ^= b ^ (b >> shift);
-    return a;
-}
-
-uint32_t interleaveXY(uint16_t x, uint16_t y) {
-    uint32_t res = (y << 16) | x;
-    res = delta_swap(res, 0b00000000111111110000000000000000, 8);
-    res = delta_swap(res, 0b00001111000000000000111100000000, 4);
-    res = delta_swap(res, 0b00110000001100000011000000110000, 2);
-    res = delta_swap(res, 0b01000100010001000100010001000100, 1);
-    return res;
-}
-
-enum Cell : uint8_t {
-    Dead = 0,
-    Alive = 1,
-    Dying = 3,
-    Birthing = 2,
-    DeadVisited = 4,
-};
-
-// Z-curve
-class GameField {
-    static const uint32_t MASK_X = 0b01010101010101010101010101010101;
-    static const uint32_t MASK_Y = 0b10101010101010101010101010101010;
+class Game {
+    sf::VertexArray cells{sf::Quads};
+    sf::VertexArray grid{sf::Quads};
+    sf::Texture density_texture;
+    std::vector<uint8_t> density_pixels;
+    static const unsigned int grid_thickness_threshold =
+        (CELL_SIZE_INIT + DRAW_GRID_THRESHOLD) / 2;
+    unsigned int grid_thickness;
+    size_t size;
+    uint64_t loads = 0;
+    sf::VertexArray hud_bars{sf::Quads};
+    // the view the canvas was drawn for, it is repainted in full when
+    // any of it changes
+    struct CanvasView {
+        int origin_x, origin_y;
+        unsigned int cell_size, level, width, height;
+        int64_t x0, y0;
+        size_t w, h;
 
-    uint8_t n;
-    size_t size_x;
-    size_t size_y;
+        bool operator==(const CanvasView &other) const = default;
+    };
+    sf::RenderTexture canvas;
+    CanvasView drawn = {};
+    bool canvas_valid = false;
+    // the cells on the canvas, in the layout of the snapshot it was drawn from
+    std::vector<uint64_t> drawn_bits;
+    bool fresh = true;
+    sf::VertexArray progress_bar{sf::Quads};
+    // the window shows a progress bar that has to go once the load or save is done
+    bool progress_shown = false;
 public:
-    Cell *cells;
-    size_t size;
-    size_t idx;
+    Simulation sim;
+    Profiler profiler;
+    bool hud = false;
+    sf::Window &window;
+    unsigned int cell_size;
+    // zoomed out past one pixel per cell every pixel is a 2^level block
+    unsigned int level = 0;
+    int origin_x, origin_y;
 
-    GameField(size_t size) : size(size), idx(0) {
-        const uint8_t bits = sizeof(size) * 8;
-        uint8_t n;
-        for (n = 0; n < bits; (size >>= 1, ++n)) {
-            if (size & 1) {
-                size >>= 1;
-                break;
-            }
-        }
-        if (n == bits || size) {
-            throw std::invalid_argument("size needs to be power of 2");
-        }
-        if (n > 12) {
-            throw std::invalid_argument("size >4096 not supported");
-        }
-        this->n = n;
-        size_t len = 1 << (n << 1);
-        cells = new Cell[len];
-        memset(cells, Dead, len);
-        size_x = interleaveXY(this->size, 0);
-        size_y = size_x << 1;
+    Game(const std::string &engine_name, size_t size, const EngineOptions &options,
+            sf::Window &window) : 
+        grid_thickness(GRID_THICKNESS),
+        size(size),
+        sim(engine_name, size, options),
+        window(window),
+        cell_size(CELL_SIZE_INIT)
+    {
+        center();
     }
 
-    ~GameField() {
-        delete[] cells;
+    void center() {
+        sf::Vector2u window_size = window.getSize();
+        size_t field_center = ((size >> level) * cell_size) / 2;
+        origin_x = field_center - window_size.x / 2;
+        origin_y = field_center - window_size.y / 2;
     }
 
-    GameField &operator=(GameField &&other) {
-        this->~GameField();
-        std::memmove(this, &other, sizeof(GameField));
-        other.cells = nullptr;
-        return *this;
+    // centred once the simulation has loaded it, the board runs on meanwhile
+    void openFile(std::string path) {
+        sim.load(path);
     }
 
-    void clear() {
-        size_t n = size * size;
-        for (size_t i = 0; i < n; ++i) {
-            cells[i] = Dead;
-        }
+    void saveFile(std::string path) {
+        sim.save(path);
     }
 
-    Cell setCursor(size_t x, size_t y) {
-        if (x >= size || y >= size) {
-            return DeadVisited;
-        }
-        idx = interleaveXY(x, y);
-        return cells[idx];
+    double pixelsPerCell() const {
+        return (double)cell_size / (1 << level);
     }
 
-    void toggle() {
-        cells[idx] = cells[idx] == Dead ? Alive : Dead;
+    void updateCellSize(int delta) {
+        if (delta < 0 && cell_size == 1) {
+            level = std::min(level + 1, (unsigned int)LOD_LEVEL_MAX);
+            return;
+        } else if (delta > 0 && level) {
+            --level;
+            return;
+        }
+        cell_size = std::clamp((int)cell_size + delta, 1, CELL_SIZE_MAX);
+        if (cell_size < grid_thickness_threshold) {
+            grid_thickness = GRID_THICKNESS / 2;
+        } else {
+            grid_thickness = GRID_THICKNESS;
+        }
     }
 
-    void setAlive(uint32_t *idxs, size_t len) {
-        size_t max_idx = size * size;
-        for (size_t i = 0; i < len; ++i) {
-            size_t idx = idxs[i];
-            if (idx < max_idx) {
-                cells[idx] = Alive;
+    // takes the newest generation and requests the cells drawn next
+    void update() {
+        if (sim.update()) {
+            fresh = true;
+            const Snapshot &snap = sim.snapshot();
+            size = snap.size;
+            if (snap.loads != loads) {
+                loads = snap.loads;
+                center();
+            }
+            if (snap.level) {
+                updateDensityTexture(snap);
             }
         }
+        sim.setViewport(viewportFor(window.getSize()));
     }
 
-    Cell right(uint8_t mask = Alive) {
-        uint32_t y = idx & MASK_Y;
-        uint32_t x = ((idx | MASK_Y) + 1) & MASK_X;
-        idx = y | x;
-        if (x >= size_x || y >= size_y) {
-            return (Cell)(DeadVisited & mask);
+    // the cells a target of that size shows from the origin
+    Viewport viewportFor(sf::Vector2u target_size) const {
+        Viewport view;
+        view.level = level;
+        if (level) {
+            view.x0 = origin_x;
+            view.y0 = origin_y;
+            view.w = target_size.x;
+            view.h = target_size.y;
+            return view;
         }
-        return (Cell)(cells[idx] & mask);
+        view.x0 = pixelToCoord(origin_x);
+        view.y0 = pixelToCoord(origin_y);
+        view.w = pixelToCoord(origin_x + (int)target_size.x - 1) - view.x0 + 1;
+        view.h = pixelToCoord(origin_y + (int)target_size.y - 1) - view.y0 + 1;
+        return view;
     }
 
-    Cell left(uint8_t mask = Alive) {
-        uint32_t y = idx & MASK_Y;
-        uint32_t x = ((idx & MASK_X) - 1) & MASK_X;
-        idx = y | x;
-        if (x >= size_x || y >= size_y) {
-            return (Cell)(DeadVisited & mask);
-        }
-        return (Cell)(cells[idx] & mask);
+    // cell coordinate under a pixel offset from the origin, rounding down
+    int64_t pixelToCoord(int64_t pixel) const {
+        int64_t size = cell_size;
+        return (pixel >= 0 ? pixel / size : -((-pixel + size - 1) / size)) * (1ll << level);
     }
 
-    Cell up(uint8_t mask = Alive) {
-        uint32_t x = idx & MASK_X;
-        uint32_t y = ((idx & MASK_Y) - 1) & MASK_Y;
-        idx = x | y;
-        if (y >= size_y || x >= size_x) {
-            return (Cell)(DeadVisited & mask);
+    // darker the more cells of the block are alive, blocks with any alive
+    // cells stay visible
+    void updateDensityTexture(const Snapshot &snap) {
+        if (density_texture.getSize().x != snap.w || density_texture.getSize().y != snap.h) {
+            density_texture.create(snap.w, snap.h);
         }
-        return (Cell)(cells[idx] & mask);
-    }
-
-    Cell down(uint8_t mask = Alive) {
-        uint32_t x = idx & MASK_X;
-        uint32_t y = ((idx | MASK_X) + 1) & MASK_Y;
-        idx = x | y;
-        if (y >= size_y || x >= size_x) {
-            return (Cell)(DeadVisited & mask);
+        density_pixels.resize(snap.w * snap.h * 4);
+        uint64_t area = 1ull << (2 * snap.level);
+        for (size_t i = 0; i < snap.w * snap.h; ++i) {
+            uint32_t count = snap.density[i];
+            uint8_t shade = count ? 191 - 191 * count / area : 255;
+            density_pixels[i * 4] = density_pixels[i * 4 + 1] = density_pixels[i * 4 + 2] = shade;
+            density_pixels[i * 4 + 3] = 255;
         }
-        return (Cell)(cells[idx] & mask);
+        density_texture.update(density_pixels.data());
     }
 
-    unsigned char countAliveNeighbors() {
-        unsigned char count = 0;
-        size_t old_idx = idx;
-        count += up();
-        count += left();
-        count += down();
-        count += down();
-        count += right();
-        count += right();
-        count += up();
-        count += up();
-        idx = old_idx;
-        return count;
+    // first coordinate drawn along an axis and the pixel it starts at
+    void visibleStart(int origin, int64_t &coord, int &pixel) const {
+        coord = pixelToCoord(origin);
+        if (sim.snapshot().bounded) {
+            coord = std::clamp<int64_t>(coord, 0, size);
+        }
+        pixel = coord * cell_size - origin;
     }
 
-    void updateCell() {
-        unsigned char alive_neighbors = countAliveNeighbors();
-        if (cells[idx] == Alive && (alive_neighbors < 2 || alive_neighbors > 3)) {
-            cells[idx] = Dying;
-        } else if (cells[idx] == Dead) {
-            cells[idx] = alive_neighbors == 3 ? Birthing : DeadVisited;
+    void toggleAt(int window_x, int window_y) {
+        if (level) {
+            return;
+        }
+        int64_t coord_x = pixelToCoord(window_x + origin_x);
+        int64_t coord_y = pixelToCoord(window_y + origin_y);
+        int64_t size = this->size;
+        if (!sim.snapshot().bounded
+                || (coord_x >= 0 && coord_y >= 0 && coord_x < size && coord_y < size)) {
+            sim.post([coord_x, coord_y](std::unique_ptr<Engine> &field) {
+                field->toggle(coord_x, coord_y);
+            });
         }
     }
 
-    void populateRandom() {
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dist(0, 1);
-        size_t len = size * size;
-        for (size_t i = 0; i < len; ++i) {
-            cells[i] = (Cell)dist(gen);
+    // cells drawn along an axis from the pixel the first one starts at
+    int64_t visibleCount(int pixel, unsigned int window_len) const {
+        if (pixel >= (int)window_len) {
+            return 0;
         }
+        return ((int)window_len - pixel + cell_size - 1) / cell_size;
     }
-};
-
-class Game {
-    sf::RectangleShape shape_alive;
-    static const unsigned int grid_thickness_threshold =
-        (CELL_SIZE_INIT + DRAW_GRID_THRESHOLD) / 2;
-    unsigned int grid_thickness;
-public:
-    GameField field;
-    sf::Window &window;
-    unsigned int cell_size;
-    int origin_x, origin_y;
 
-    Game(size_t size, sf::Window &window) : 
-        field(size),
-        window(window),
-        cell_size(CELL_SIZE_INIT),
-        grid_thickness(GRID_THICKNESS)
+    static void appendQuad(sf::VertexArray &quads, float x, float y, float w, float h,
+            sf::Color color = sf::Color::Black)
     {
-        shape_alive = sf::RectangleShape(sf::Vector2f(CELL_SIZE_INIT, CELL_SIZE_INIT));
-        shape_alive.setFillColor(sf::Color::Black);
-        sf::Vector2u window_size = window.getSize();
-        center();
+        quads.append(sf::Vertex(sf::Vector2f(x, y), color));
+        quads.append(sf::Vertex(sf::Vector2f(x + w, y), color));
+        quads.append(sf::Vertex(sf::Vector2f(x + w, y + h), color));
+        quads.append(sf::Vertex(sf::Vector2f(x, y + h), color));
     }
 
-    void center() {
+    // live cells and grid lines are one vertex array each, so a frame is two
+    // draw calls however many cells are alive
+    void draw(sf::RenderTarget &window) {
         sf::Vector2u window_size = window.getSize();
-        size_t field_center = (field.size * cell_size) / 2;
-        origin_x = field_center - window_size.x / 2;
-        origin_y = field_center - window_size.y / 2;
-    }
-
-    void openFile(std::string path) {
-        std::ifstream file(path, std::ios::binary | std::ios::in | std::ios::ate);
-        if (!file.is_open()) {
-            std::cerr << "Error: unable to open file " << path << std::endl;
+        int pixel_x_start, pixel_y_start;
+        int64_t coord_x_start, coord_y_start;
+        visibleStart(origin_x, coord_x_start, pixel_x_start);
+        visibleStart(origin_y, coord_y_start, pixel_y_start);
+        const Snapshot &snap = sim.snapshot();
+        int64_t size = snap.bounded ? this->size : INT64_MAX - 1;
+        int64_t count_x = visibleCount(pixel_x_start, window_size.x);
+        int64_t count_y = visibleCount(pixel_y_start, window_size.y);
+        int64_t coord_x_end = std::min(size, coord_x_start + count_x);
+        int64_t coord_y_end = std::min(size, coord_y_start + count_y);
+        if (snap.texture) {
+            // gpu engines hand over the board as a texture, scaled up as is
+            sf::Sprite board(snap.texture->getTexture());
+            board.setScale(pixelsPerCell(), pixelsPerCell());
+            board.setPosition(-origin_x, -origin_y);
+            window.draw(board);
+            PROFILE_DRAW_CALL(profiler);
+        }
+        if (snap.level != level) {
+            return;
+        } else if (level) {
+            if (!snap.density.empty()) {
+                sf::Sprite blocks(density_texture);
+                blocks.setPosition(snap.x0 - origin_x, snap.y0 - origin_y);
+                window.draw(blocks);
+                PROFILE_DRAW_CALL(profiler);
+            }
             return;
         }
-        std::streampos size = file.tellg();
-        if (size < 4 && size % 4 != 0) {
-            std::cerr << "Error: wrong file format";
-        }
-        size_t len = size / 4;
-        uint32_t *idxs = new uint32_t[len];
-        file.seekg(0, std::ios::beg);
-        file.read((char *)idxs, size);
-        file.close();
-        size_t new_size = idxs[0];
-        if (new_size != field.size) {
-            try {
-                field = std::move(GameField(new_size));
-            } catch (const std::invalid_argument &e) {
-                std::cerr << e.what() << std::endl;
-                return;
-            } 
-        }
-        field.clear();
-        field.setAlive(idxs + 1, len - 1);
-        center();
+        // cleared arrays keep their storage, so this allocates only when the
+        // number of live cells on screen grows
+        cells.clear();
+        int64_t row_start = std::max(coord_y_start, snap.y0);
+        int64_t row_end = std::min(coord_y_end, snap.y0 + (int64_t)snap.h);
+        for (int64_t coord_y = row_start; coord_y < row_end; ++coord_y) {
+            const uint64_t *row = &snap.bits[(coord_y - snap.y0) * snap.stride];
+            int pixel_y = pixel_y_start + (coord_y - coord_y_start) * cell_size;
+            for (size_t w = 0; w < snap.stride; ++w) {
+                uint64_t word = row[w];
+                while (word) {
+                    int64_t coord_x = snap.x0 + (int64_t)(w * 64) + __builtin_ctzll(word);
+                    word &= word - 1;
+                    if (coord_x >= coord_x_start && coord_x < coord_x_end) {
+                        int pixel_x = pixel_x_start + (coord_x - coord_x_start) * cell_size;
+                        appendQuad(cells, pixel_x, pixel_y, cell_size, cell_size);
+                    }
+                }
+            }
+        }
+        window.draw(cells);
+        PROFILE_DRAW_CALL(profiler);
+        if (cell_size >= DRAW_GRID_THRESHOLD) {
+            unsigned int horiz_len = (coord_x_end - coord_x_start) * cell_size;
+            unsigned int vert_len = (coord_y_end - coord_y_start) * cell_size;
+            grid.clear();
+            int64_t lines_y = std::min(coord_y_start + count_y, size + 1) - coord_y_start;
+            for (int64_t i = 0; i < lines_y; ++i) {
+                appendQuad(grid, pixel_x_start, pixel_y_start + i * cell_size,
+                    horiz_len, grid_thickness);
+            }
+            int64_t lines_x = std::min(coord_x_start + count_x, size + 1) - coord_x_start;
+            for (int64_t i = 0; i < lines_x; ++i) {
+                appendQuad(grid, pixel_x_start + i * cell_size, pixel_y_start,
+                    grid_thickness, vert_len);
+            }
+            window.draw(grid);
+            PROFILE_DRAW_CALL(profiler);
+        }
     }
 
-    void saveFile(std::string path) {
-        if (!path.ends_with(".gol")) {
-            path += ".gol";
+    // only the cells that flipped since the canvas was drawn, inside the
+    // grid lines so those stay
+    void repaint(const Snapshot &snap) {
+        int pixel_x_start, pixel_y_start;
+        int64_t coord_x_start, coord_y_start;
+        visibleStart(origin_x, coord_x_start, pixel_x_start);
+        visibleStart(origin_y, coord_y_start, pixel_y_start);
+        int inset = cell_size >= DRAW_GRID_THRESHOLD ? grid_thickness : 0;
+        cells.clear();
+        for (size_t i = 0; i < drawn_bits.size(); ++i) {
+            uint64_t flipped = drawn_bits[i] ^ snap.bits[i];
+            drawn_bits[i] = snap.bits[i];
+            int64_t coord_y = snap.y0 + (int64_t)(i / snap.stride);
+            int pixel_y = pixel_y_start + (coord_y - coord_y_start) * cell_size;
+            while (flipped) {
+                int bit = __builtin_ctzll(flipped);
+                flipped &= flipped - 1;
+                int64_t coord_x = snap.x0 + (int64_t)(i % snap.stride * 64) + bit;
+                int pixel_x = pixel_x_start + (coord_x - coord_x_start) * cell_size;
+                bool alive = (snap.bits[i] >> bit) & 1;
+                appendQuad(cells, pixel_x + inset, pixel_y + inset, cell_size - inset,
+                    cell_size - inset, alive ? sf::Color::Black : sf::Color::White);
+            }
         }
-        std::ofstream file(path, std::ios::binary | std::ios::out);
-        if (!file.is_open()) {
-            std::cerr << "Error: unable to open file " << path << std::endl;
-            return;
+        canvas.draw(cells);
+        PROFILE_DRAW_CALL(profiler);
+    }
+
+    // the board is kept drawn on a canvas: a new generation only repaints
+    // the cells that flipped, panning, zooming or a new viewport redraw it
+    // all; false when the window already shows all there is
+    bool present(sf::RenderWindow &window) {
+        sf::Vector2u window_size = window.getSize();
+        const Snapshot &snap = sim.snapshot();
+        CanvasView view = {origin_x, origin_y, cell_size, level, window_size.x, window_size.y,
+            snap.x0, snap.y0, snap.w, snap.h};
+        bool same = canvas_valid && view == drawn;
+        bool busy = sim.ioProgress().busy;
+        if (same && !fresh && !hud && !busy && !progress_shown) {
+            return false;
         }
-        std::vector<uint32_t> vec{};
-        vec.push_back(field.size);
-        uint32_t len = field.size * field.size;
-        for (uint32_t i = 0; i < len; ++i) {
-            if (field.cells[i] == Alive) {
-                vec.push_back(i);
+        // cells only, density and gpu textures are one sprite anyway
+        bool cells_only = !level && !snap.level && !snap.texture;
+        if (same && fresh && cells_only) {
+            repaint(snap);
+            canvas.display();
+        } else if (!same || fresh) {
+            if (canvas.getSize().x != window_size.x || canvas.getSize().y != window_size.y) {
+                canvas.create(window_size.x, window_size.y);
+            }
+            canvas.clear(sf::Color::White);
+            draw(canvas);
+            canvas.display();
+            if (cells_only) {
+                drawn_bits = snap.bits;
             }
         }
-        file.write((char *)vec.data(), vec.size() * 4);
-        file.close();
+        drawn = view;
+        canvas_valid = true;
+        fresh = false;
+        window.draw(sf::Sprite(canvas.getTexture()));
+        PROFILE_DRAW_CALL(profiler);
+        if (hud) {
+            drawHud(window);
+        }
+        if (busy) {
+            drawProgress(window);
+        }
+        progress_shown = busy;
+        return true;
     }
 
-    void updateCellSize(int delta) {
-        cell_size = std::clamp((int)cell_size + delta, 1, CELL_SIZE_MAX);
-        shape_alive.setSize(sf::Vector2f(cell_size, cell_size));
-        if (cell_size < grid_thickness_threshold) {
-            grid_thickness = GRID_THICKNESS / 2;
-        } else {
-            grid_thickness = GRID_THICKNESS;
-        }
+    // of the load or save in flight, along the top
+    void drawProgress(sf::RenderWindow &window) {
+        float width = window.getSize().x;
+        progress_bar.clear();
+        appendQuad(progress_bar, 0, 0, width, PROGRESS_BAR_HEIGHT, sf::Color(192, 192, 192));
+        appendQuad(progress_bar, 0, 0, width * sim.ioProgress().fraction(), PROGRESS_BAR_HEIGHT,
+            sf::Color(0, 128, 255));
+        window.draw(progress_bar);
+        PROFILE_DRAW_CALL(profiler);
     }
 
-    void simulationTick() {
-        const uint8_t mask = Alive | DeadVisited;
-        size_t idx = 0;
-        for (size_t y = 0; y < field.size; ++y) {
-            for (size_t x = 0; x < field.size; ++x) {
-                Cell cell = field.cells[idx];
-                if (cell == Alive) {
-                    field.idx = idx;
-                    field.updateCell();
-                    if (field.up(mask) == Dead)
-                        field.updateCell();
-                    if (field.left(mask) == Dead)
-                        field.updateCell();
-                    if (field.down(mask) == Dead)
-                        field.updateCell();
-                    if (field.down(mask) == Dead)
-                        field.updateCell();
-                    if (field.right(mask) == Dead)
-                        field.updateCell();
-                    if (field.right(mask) == Dead)
-                        field.updateCell();
-                    if (field.up(mask) == Dead)
-                        field.updateCell();
-                    if (field.up(mask) == Dead)
-                        field.updateCell();
+    // the phases of the last frames as stacked bars along the bottom, a
+    // frame at 60 fps is PROFILE_FRAME_PIXELS high
+    void drawHud(sf::RenderWindow &window) {
+        static const sf::Color colors[PHASE_COUNT] = {
+            sf::Color(0, 128, 255), sf::Color(0, 192, 0), sf::Color(255, 128, 0),
+            sf::Color(192, 0, 192),
+        };
+        float bottom = window.getSize().y;
+        hud_bars.clear();
+        size_t frames = std::min<size_t>(profiler.frameCount(), PROFILE_FRAMES);
+        for (size_t i = 0; i < frames; ++i) {
+            const FrameRecord &r = profiler.previous(i);
+            float x = PROFILE_FRAMES - 1 - i, y = bottom;
+            for (int p = 0; p < PHASE_COUNT; ++p) {
+                float h = r.phase_us[p] * PROFILE_FRAME_PIXELS / 16667.0f;
+                appendQuad(hud_bars, x, y - h, 1, h);
+                for (size_t v = hud_bars.getVertexCount() - 4; v < hud_bars.getVertexCount(); ++v) {
+                    hud_bars[v].color = colors[p];
                 }
-                ++idx;
+                y -= h;
             }
         }
-        idx = 0;
-        for (size_t y = 0; y < field.size; ++y) {
-            for (size_t x = 0; x < field.size; ++x) {
-                Cell cell = field.cells[idx];
-                if (cell == Birthing) {
-                    field.cells[idx] = Alive;
-                } else if (cell == Dying || cell == DeadVisited) {
-                    field.cells[idx] = Dead;
-                }
-                ++idx;
+        appendQuad(hud_bars, 0, bottom - PROFILE_FRAME_PIXELS, PROFILE_FRAMES, 1);
+        window.draw(hud_bars);
+    }
+
+    // numbers of the last frame, there is no font to draw them with
+    void updateTitle(sf::RenderWindow &window) {
+        const FrameRecord &r = profiler.previous(0);
+        char title[256];
+        std::snprintf(title, sizeof(title),
+            "gen %llu pop %llu tick %.2f ms visited %llu draw %.2f ms calls %llu",
+            (unsigned long long)r.generation, (unsigned long long)r.step.population,
+            r.step.tick_us / 1000.0, (unsigned long long)r.step.cells_visited,
+            r.phase_us[PHASE_DRAW] / 1000.0, (unsigned long long)r.draw_calls);
+        window.setTitle(title);
+    }
+};
+
+// takes what is drawn on it and does nothing: without an active context
+// RenderTarget skips the GL calls, so draw() is timed on the cpu alone
+class NullTarget : public sf::RenderTarget {
+    sf::Vector2u target_size;
+public:
+    NullTarget(unsigned int width, unsigned int height) : target_size(width, height) {}
+
+    sf::Vector2u getSize() const override {
+        return target_size;
+    }
+
+    bool setActive(bool /*active*/ = true) override {
+        return false;
+    }
+};
+
+// a frame of a soup on a MICROBENCH_DRAW_WIDTH x MICROBENCH_DRAW_HEIGHT
+// target at a few cell sizes, with the grid from DRAW_GRID_THRESHOLD on
+void benchDraw(MicroBench &bench, const std::string &engine_name, const EngineOptions &options,
+        const SoupOptions &soup)
+{
+    sf::Window window;
+    Game game(engine_name, FIELD_SIZE_INIT, options, window);
+    NullTarget target(MICROBENCH_DRAW_WIDTH, MICROBENCH_DRAW_HEIGHT);
+    game.sim.post([soup](std::unique_ptr<Engine> &field) {
+        field->populateRandom(soup);
+    });
+    for (unsigned int cell_size : {1, 4, 25}) {
+        game.cell_size = cell_size;
+        game.origin_x = game.origin_y = 0;
+        Viewport view = game.viewportFor(target.getSize());
+        game.sim.setViewport(view);
+        // the snapshot of this viewport is published after the soup
+        while (game.sim.snapshot().w != view.w || game.sim.snapshot().h != view.h) {
+            if (!game.sim.update()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
             }
         }
+        bench.run("draw", cell_size, [&](uint64_t n) {
+            for (uint64_t k = 0; k < n; ++k) {
+                game.draw(target);
+            }
+        });
     }
+}
 
-    void draw(sf::RenderWindow &window) {
-        sf::Vector2u window_size = window.getSize();
-        int pixel_x_start, pixel_y_start, pixel_x, pixel_y;
-        size_t coord_x_start, coord_y_start, coord_x, coord_y;
-        if (origin_x <= 0) {
-            pixel_x_start = -origin_x;
-            coord_x_start = 0;
+int main(int argc, char **argv) {
+    std::string engine_name = ENGINE_INIT;
+    size_t size = 0;
+    size_t threads = std::thread::hardware_concurrency();
+    EngineOptions options;
+    std::string headless_path;
+    bool bench = false;
+    bool microbench = false;
+    std::string bench_out, baseline;
+    double threshold = MICROBENCH_THRESHOLD_INIT;
+    bool compress = false;
+    CheckpointOptions checkpoint;
+    uint64_t generations = 0;
+    CensusOptions census;
+    SoupOptions soup;
+    bool hud = false;
+    size_t history_mb = HISTORY_MB_INIT;
+    std::string trace_path;
+    bool detect_cycles = false, stop_on_cycle = false;
+    bool tune_time_block = false;
+    std::vector<ClusterNode> cluster_nodes;
+    size_t rank = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--engine" && i + 1 < argc) {
+            engine_name = argv[++i];
+        } else if (arg == "--size" && i + 1 < argc) {
+            size = std::stoul(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::stoul(argv[++i]);
+        } else if (arg == "--double-buffer") {
+            options.double_buffer = true;
+        } else if (arg == "--step-exp" && i + 1 < argc) {
+            options.step_exp = std::stoul(argv[++i]);
+        } else if (arg == "--time-block" && i + 1 < argc) {
+            std::string value = argv[++i];
+            tune_time_block = value == "auto";
+            options.time_block = tune_time_block ? 1 : std::stoul(value);
+        } else if (arg == "--rule" && i + 1 < argc) {
+            if (!parseRule(argv[++i], options.rule)) {
+                std::cerr << "Error: unsupported rule " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--huge-pages") {
+            PagePool::instance().setHugeTlb(true);
+        } else if (arg == "--torus") {
+            options.topology = Topology::Torus;
+        } else if (arg == "--headless" && i + 1 < argc) {
+            headless_path = argv[++i];
+        } else if (arg == "--compress") {
+            compress = true;
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpoint.path = argv[++i];
+        } else if (arg == "--checkpoint-every" && i + 1 < argc) {
+            checkpoint.every = std::stoull(argv[++i]);
+        } else if (arg == "--resume") {
+            checkpoint.resume = true;
+        } else if (arg == "--detect-cycles") {
+            detect_cycles = true;
+        } else if (arg == "--stop-on-cycle") {
+            detect_cycles = stop_on_cycle = true;
+        } else if (arg == "--census" && i + 1 < argc) {
+            census.soups = std::stoull(argv[++i]);
+        } else if (arg == "--soup-size" && i + 1 < argc) {
+            census.soup_size = std::stoul(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            soup.seed = std::stoull(argv[++i]);
+        } else if (arg == "--density" && i + 1 < argc) {
+            soup.density = std::stod(argv[++i]);
+        } else if (arg == "--cluster" && i + 1 < argc) {
+            if (!parseClusterNodes(argv[++i], cluster_nodes)) {
+                return 1;
+            }
+        } else if (arg == "--rank" && i + 1 < argc) {
+            rank = std::stoul(argv[++i]);
+        } else if (arg == "--history" && i + 1 < argc) {
+            history_mb = std::stoul(argv[++i]);
+        } else if (arg == "--hud") {
+            hud = true;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (arg == "--bench") {
+            bench = true;
+        } else if (arg == "--microbench") {
+            microbench = true;
+        } else if (arg == "--bench-out" && i + 1 < argc) {
+            bench_out = argv[++i];
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            baseline = argv[++i];
+        } else if (arg == "--threshold" && i + 1 < argc) {
+            threshold = std::stod(argv[++i]);
+        } else if (arg == "--generations" && i + 1 < argc) {
+            generations = std::stoull(argv[++i]);
         } else {
-            pixel_x_start = -(origin_x % cell_size);
-            coord_x_start = std::min(origin_x / cell_size, (unsigned int)field.size);
+            std::cerr << "usage: " << argv[0]
+                << " [--engine " ENGINE_NAMES "] [--size N] [--threads N]"
+                << " [--double-buffer] [--step-exp K] [--time-block K|auto] [--rule B3/S23]"
+                << " [--torus] [--huge-pages]"
+                << " [--compress] [--checkpoint FILE [--checkpoint-every N] [--resume]]"
+                << " [--headless FILE | --bench] [--generations N]"
+                << " [--microbench [--bench-out FILE.json] [--baseline FILE.json] [--threshold P]]"
+                << " [--detect-cycles | --stop-on-cycle]"
+                << " [--census N [--soup-size S]] [--seed X] [--density P]"
+                << " [--cluster HOST:PORT,... [--rank R]]"
+                << " [--hud] [--trace FILE.csv|FILE.json] [--history MB]" << std::endl;
+            return 1;
         }
-        if (origin_y <= 0) {
-            pixel_y_start = -origin_y;
-            coord_y_start = 0;
-        } else {
-            pixel_y_start = -(origin_y % cell_size);
-            coord_y_start = std::min(origin_y / cell_size, (unsigned int)field.size);
+    }
+    // a blocked board only shows every k-th generation to the detector
+    if ((tune_time_block || options.time_block > 1) && (detect_cycles || census.soups)) {
+        std::cerr << "Error: cycles are looked for one generation at a time, --time-block needs 1"
+            << std::endl;
+        return 1;
+    }
+    std::unique_ptr<ThreadPool> pool;
+    if (threads) {
+        pool = std::make_unique<ThreadPool>(threads);
+        options.pool = pool.get();
+    }
+    // every node runs with the same list, the nodes other than rank 0 only
+    // serve their strips of the boards the coordinator makes
+    std::unique_ptr<Cluster> cluster;
+    if (!cluster_nodes.empty()) {
+        cluster = std::make_unique<Cluster>();
+        if (!cluster->connect(cluster_nodes, rank)) {
+            return 1;
         }
-        Cell cell = field.setCursor(coord_x_start, coord_y_start);
-        for ((pixel_y = pixel_y_start, coord_y = coord_y_start);
-                pixel_y < (int)window_size.y && coord_y < field.size;
-                (pixel_y += cell_size, ++coord_y))
-        {
-            size_t idx = field.idx;
-            for ((pixel_x = pixel_x_start, coord_x = coord_x_start);
-                    pixel_x < (int)window_size.x && coord_x < field.size;
-                    (pixel_x += cell_size, ++coord_x))
-            {
-                if (cell == Alive) {
-                    shape_alive.setPosition(pixel_x, pixel_y);
-                    window.draw(shape_alive);
-                }
-                cell = field.right();
-            }
-            field.idx = idx;
-            cell = field.down();
+        if (rank > 0) {
+            return runClusterNode(*cluster, options);
         }
-        unsigned int horiz_len = pixel_x - pixel_x_start;
-        unsigned int vert_len = pixel_y - pixel_y_start;
-        if (cell_size >= DRAW_GRID_THRESHOLD) {
-            sf::RectangleShape shape_line_horiz(sf::Vector2f(horiz_len, grid_thickness));
-            shape_line_horiz.setFillColor(sf::Color::Black);
-            for ((pixel_y = pixel_y_start, coord_y = coord_y_start);
-                    pixel_y < (int)window_size.y && coord_y <= field.size;
-                    (pixel_y += cell_size, ++coord_y))
-            {
-                shape_line_horiz.setPosition(pixel_x_start, pixel_y);
-                window.draw(shape_line_horiz);
-            }
-            sf::RectangleShape shape_line_vert(sf::Vector2f(grid_thickness, vert_len));
-            shape_line_vert.setFillColor(sf::Color::Black);
-            for ((pixel_x = pixel_x_start, coord_x = coord_x_start);
-                    pixel_x < (int)window_size.x && coord_x <= field.size;
-                    (pixel_x += cell_size, ++coord_x))
-            {
-                shape_line_vert.setPosition(pixel_x, pixel_y_start);
-                window.draw(shape_line_vert);
-            }
+        options.cluster = cluster.get();
+        engine_name = "cluster";
+    }
+    checkpoint.compress = compress;
+    if (census.soups) {
+        // small boards by default, a soup settles long before it spreads
+        if (generations) {
+            census.max_generations = generations;
         }
+        census.soup = soup;
+        return runCensus(engine_name, size ? size : CENSUS_FIELD_SIZE_INIT, options, census);
+    }
+    if (microbench) {
+        // before the run, which takes a while
+        std::vector<MicroResult> baseline_results;
+        if (!baseline.empty() && !MicroBench::readJson(baseline, baseline_results)) {
+            return 1;
+        }
+        MicroBench cases;
+        runMicroBenchmarks(cases, options, soup);
+        benchDraw(cases, engine_name, options, soup);
+        return finishMicroBenchmarks(cases, bench_out, baseline.empty() ? nullptr : &baseline_results,
+            threshold);
+    }
+    size = size ? size : FIELD_SIZE_INIT;
+    generations = generations ? generations : HEADLESS_GENERATIONS_INIT;
+    // only when asked, the fastest time block for the size; headless runs
+    // tune once the board is loaded
+    if (engine_name == "swar" && tune_time_block && headless_path.empty()) {
+        options.time_block = tuneTimeBlock(size, options, soup, TIME_BLOCK_TUNE_SECONDS);
+    }
+    if (bench) {
+        return runBenchmark(engine_name, options, generations, soup);
+    } else if (!headless_path.empty()) {
+        CycleDetector cycles(stop_on_cycle);
+        return runHeadless(headless_path, engine_name, options, generations, checkpoint,
+            detect_cycles ? &cycles : nullptr, tune_time_block ? &soup : nullptr);
     }
-};
-
-int main() {
     sf::RenderWindow window(sf::VideoMode(512, 512), "SFML");
     window.setVerticalSyncEnabled(true);
     window.setFramerateLimit(60);
     window.setKeyRepeatEnabled(false);
-    Game game(2048, window);
+    std::unique_ptr<Game> game_ptr;
+    try {
+        game_ptr = std::make_unique<Game>(engine_name, size, options, window);
+    } catch (const std::invalid_argument &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    Game &game = *game_ptr;
+    game.sim.setCompressSaves(compress);
+    // before the checkpoints start counting
+    if (checkpoint.canResume()) {
+        game.sim.loadNow(patternPath(checkpoint.path));
+    }
+    if (!checkpoint.path.empty()) {
+        game.sim.startCheckpoints(checkpoint);
+    }
+    if (detect_cycles) {
+        game.sim.detectCycles(stop_on_cycle);
+    }
+    game.sim.keepHistory(history_mb << 20);
+    game.hud = hud;
+    game.profiler.setTracing(!trace_path.empty());
+    game.sim.setProfiling(hud || !trace_path.empty());
     unsigned int old_mouse_x, old_mouse_y;
     bool panning_mode = false;
-    bool simulating = false;
-    unsigned int frames_till_next_tick = 0;
     unsigned int frames_per_tick = FRAMES_PER_TICK_INIT;
+    game.sim.setInterval(std::chrono::microseconds(1000000 * frames_per_tick / 60));
     while (window.isOpen()) {
         sf::Event event;
-        while (window.pollEvent(event)) {
-            switch (event.type) {
-                case sf::Event::Closed:
-                    window.close();
-                    break;
-                case sf::Event::KeyPressed:
-                    if (event.key.code == sf::Keyboard::Space) {
-                        simulating = !simulating;
-                        frames_till_next_tick = 0;
-                    }
-                    if (event.key.code == sf::Keyboard::C) {
-                        game.field.clear();
-                    } else if (event.key.code == sf::Keyboard::R) {
-                        game.field.populateRandom();
-                    }
-                    if (event.key.code == sf::Keyboard::O) {
-                        std::string path = file_dialog(FileDialogMode::Open);
-                        if (!path.empty()) {
-                            game.openFile(path);
+        {
+            PROFILE_SCOPE(game.profiler, PHASE_EVENTS);
+            while (window.pollEvent(event)) {
+                switch (event.type) {
+                    case sf::Event::Closed:
+                        window.close();
+                        break;
+                    case sf::Event::KeyPressed:
+                        if (event.key.code == sf::Keyboard::Space) {
+                            game.sim.setRunning(!game.sim.isRunning());
+                        } else if (event.key.code == sf::Keyboard::M) {
+                            game.sim.setMaxSpeed(!game.sim.isMaxSpeed());
+                        } else if (event.key.code == sf::Keyboard::P) {
+                            game.hud = !game.hud;
+                            game.sim.setProfiling(game.hud || !trace_path.empty());
+                        } else if (event.key.code == sf::Keyboard::Escape) {
+                            game.sim.cancelIo();
+                        } else if (event.key.code == sf::Keyboard::Left) {
+                            game.sim.rewind(event.key.shift ? REWIND_SHIFT_GENERATIONS : 1);
                         }
-                    } else if (event.key.code == sf::Keyboard::S) {
-                        std::string path = file_dialog(FileDialogMode::Save);
-                        if (!path.empty()) {
-                            game.saveFile(path);
+                        if (event.key.code == sf::Keyboard::C) {
+                            game.sim.post([](std::unique_ptr<Engine> &field) { field->clear(); });
+                        } else if (event.key.code == sf::Keyboard::R) {
+                            // the soup after the last one from the same --seed
+                            game.sim.post([next = soup](std::unique_ptr<Engine> &field) {
+                                field->populateRandom(next);
+                            });
+                            ++soup.seed;
                         }
-                    }
-                    if (event.key.code == sf::Keyboard::Up) {
-                        if (frames_per_tick > 10) {
-                            frames_per_tick -= 10;
-                        } else if (frames_per_tick > 5) {
-                            frames_per_tick -= 5;
-                        } else if (frames_per_tick > 1) {
-                            frames_per_tick -= 2;
-                        }
-                    } else if (event.key.code == sf::Keyboard::Down) {
-                        if (frames_per_tick < 5) {
-                            frames_per_tick += 2;
-                        } else if (frames_per_tick < 10) {
-                            frames_per_tick += 5;
-                        } else if (frames_per_tick < 60) {
-                            frames_per_tick += 10;
+                        if (event.key.code == sf::Keyboard::O) {
+                            std::string path = file_dialog(FileDialogMode::Open);
+                            if (!path.empty()) {
+                                game.openFile(path);
+                            }
+                        } else if (event.key.code == sf::Keyboard::S) {
+                            std::string path = file_dialog(FileDialogMode::Save);
+                            if (!path.empty()) {
+                                game.saveFile(path);
+                            }
                         }
-                    }
-                    break;
-                case sf::Event::MouseWheelScrolled:
-                    if (event.mouseWheelScroll.wheel == sf::Mouse::VerticalWheel) {
-                        int pixel_x = event.mouseWheelScroll.x + game.origin_x;
-                        int pixel_y = event.mouseWheelScroll.y + game.origin_y;
-                        double coord_x_old = (double)pixel_x / game.cell_size;
-                        double coord_y_old = (double)pixel_y / game.cell_size;
-                        if (event.mouseWheelScroll.delta < 0) {
-                            game.updateCellSize(-SCROLL_PPF);
-                        } else {
-                            game.updateCellSize(SCROLL_PPF);
+                        if (event.key.code == sf::Keyboard::Up) {
+                            if (frames_per_tick > 10) {
+                                frames_per_tick -= 10;
+                            } else if (frames_per_tick > 5) {
+                                frames_per_tick -= 5;
+                            } else if (frames_per_tick > 1) {
+                                frames_per_tick -= 2;
+                            }
+                        } else if (event.key.code == sf::Keyboard::Down) {
+                            if (frames_per_tick < 5) {
+                                frames_per_tick += 2;
+                            } else if (frames_per_tick < 10) {
+                                frames_per_tick += 5;
+                            } else if (frames_per_tick < 60) {
+                                frames_per_tick += 10;
+                            }
                         }
-                        double coord_x = (double)pixel_x / game.cell_size;
-                        double coord_y = (double)pixel_y / game.cell_size;
-                        game.origin_x -= (coord_x - coord_x_old) * game.cell_size;
-                        game.origin_y -= (coord_y - coord_y_old) * game.cell_size;
-                    }
-                    break;
-                case sf::Event::MouseButtonPressed:
-                    if (event.mouseButton.button == sf::Mouse::Right) {
-                        panning_mode = true;
-                        old_mouse_x = event.mouseButton.x;
-                        old_mouse_y = event.mouseButton.y;
-                    }
-                    if (event.mouseButton.button == sf::Mouse::Left) {
-                        int pixel_x = event.mouseButton.x + game.origin_x;
-                        int pixel_y = event.mouseButton.y + game.origin_y;
-                        if (pixel_x >= 0 && pixel_y >= 0) {
-                            size_t coord_x = pixel_x / game.cell_size;
-                            size_t coord_y = pixel_y / game.cell_size;
-                            if (coord_x < game.field.size && coord_y < game.field.size) {
-                                game.field.setCursor(coord_x, coord_y);
-                                game.field.toggle();
+                        game.sim.setInterval(
+                            std::chrono::microseconds(1000000 * frames_per_tick / 60));
+                        break;
+                    case sf::Event::MouseWheelScrolled:
+                        if (event.mouseWheelScroll.wheel == sf::Mouse::VerticalWheel) {
+                            int pixel_x = event.mouseWheelScroll.x + game.origin_x;
+                            int pixel_y = event.mouseWheelScroll.y + game.origin_y;
+                            double coord_x_old = pixel_x / game.pixelsPerCell();
+                            double coord_y_old = pixel_y / game.pixelsPerCell();
+                            if (event.mouseWheelScroll.delta < 0) {
+                                game.updateCellSize(-SCROLL_PPF);
+                            } else {
+                                game.updateCellSize(SCROLL_PPF);
                             }
+                            double coord_x = pixel_x / game.pixelsPerCell();
+                            double coord_y = pixel_y / game.pixelsPerCell();
+                            game.origin_x -= (coord_x - coord_x_old) * game.pixelsPerCell();
+                            game.origin_y -= (coord_y - coord_y_old) * game.pixelsPerCell();
                         }
-                    }
-                    break;
-                case sf::Event::MouseButtonReleased:
-                    panning_mode = false;
-                    break;
-                default:
-                    break;
+                        break;
+                    case sf::Event::MouseButtonPressed:
+                        if (event.mouseButton.button == sf::Mouse::Right) {
+                            panning_mode = true;
+                            old_mouse_x = event.mouseButton.x;
+                            old_mouse_y = event.mouseButton.y;
+                        }
+                        if (event.mouseButton.button == sf::Mouse::Left) {
+                            game.toggleAt(event.mouseButton.x, event.mouseButton.y);
+                        }
+                        break;
+                    case sf::Event::MouseButtonReleased:
+                        panning_mode = false;
+                        break;
+                    default:
+                        break;
+                }
             }
         }
         if (window.hasFocus()) {
@@ -519,12 +796,28 @@ int main() {
                 old_mouse_y = new_pos.y;
             }
         }
-        if (simulating && frames_till_next_tick-- == 0) {
-            game.simulationTick();
-            frames_till_next_tick = frames_per_tick;
+        {
+            PROFILE_SCOPE(game.profiler, PHASE_UPDATE);
+            game.update();
+        }
+        bool presented;
+        {
+            PROFILE_SCOPE(game.profiler, PHASE_DRAW);
+            presented = game.present(window);
         }
-        window.clear(sf::Color::White);
-        game.draw(window);
-        window.display();
+        if (presented) {
+            PROFILE_SCOPE(game.profiler, PHASE_DISPLAY);
+            window.display();
+        } else {
+            sf::sleep(sf::milliseconds(IDLE_SLEEP_MS));
+        }
+        const Snapshot &snap = game.sim.snapshot();
+        game.profiler.endFrame(snap.generation, snap.stats);
+        if (game.hud && game.profiler.frameCount() % HUD_TITLE_FRAMES == 0) {
+            game.updateTitle(window);
+        }
+    }
+    if (!trace_path.empty() && !game.profiler.writeTrace(trace_path)) {
+        return 1;
     }
 }
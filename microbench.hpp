@@ -0,0 +1,306 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "engine.hpp"
+#include "engines.hpp"
+#include "gamefield.hpp"
+#include "patterns.hpp"
+#include "soup.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define MICROBENCH_MIN_SECONDS 0.2
+#define MICROBENCH_REPETITIONS 3
+// slower than the baseline by more than this many percent is a regression
+#define MICROBENCH_THRESHOLD_INIT 10.0
+
+static const size_t MICROBENCH_SIZES[] = {256, 1024, 4096};
+// gpu and cluster need a context and nodes of their own
+static const char *const MICROBENCH_ENGINES[] = {"zcurve", "swar", "lut", "list", "hashlife", "sparse"};
+
+// keeps the compiler from dropping a result nothing reads
+template <typename T>
+inline void keepResult(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct MicroResult {
+    std::string name;
+    size_t size;
+    uint64_t iterations;
+    double ns;
+};
+
+// times cases one after the other, a case runs twice as many iterations as
+// the last time until it takes MICROBENCH_MIN_SECONDS and then as many again
+// until MICROBENCH_REPETITIONS runs, keeping the fastest against noise
+class MicroBench {
+    std::vector<MicroResult> results;
+    size_t failures = 0;
+
+    static double timed(const std::function<void(uint64_t)> &body, uint64_t iterations) {
+        auto start = std::chrono::steady_clock::now();
+        body(iterations);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+public:
+    void run(const std::string &name, size_t size, const std::function<void(uint64_t)> &body) {
+        uint64_t iterations = 1;
+        double seconds;
+        while ((seconds = timed(body, iterations)) < MICROBENCH_MIN_SECONDS) {
+            iterations *= 2;
+        }
+        for (int r = 1; r < MICROBENCH_REPETITIONS; ++r) {
+            seconds = std::min(seconds, timed(body, iterations));
+        }
+        results.push_back({name, size, iterations, seconds * 1e9 / iterations});
+        std::printf("case=%s size=%zu iterations=%llu ns/op=%.2f\n", name.c_str(), size,
+            (unsigned long long)iterations, results.back().ns);
+        std::fflush(stdout);
+    }
+
+    // a case that is not timed but has to hold, as a file read back
+    void check(const std::string &name, size_t size, bool ok) {
+        failures += !ok;
+        std::printf("%scase=%s size=%zu\n", ok ? "" : "failed ", name.c_str(), size);
+        std::fflush(stdout);
+    }
+
+    size_t failed() const {
+        return failures;
+    }
+
+    // an array of objects, one per line
+    bool writeJson(const std::string &path) const {
+        FILE *f = std::fopen(path.c_str(), "w");
+        if (!f) {
+            std::fprintf(stderr, "Error: can't write %s\n", path.c_str());
+            return false;
+        }
+        std::fprintf(f, "[\n");
+        for (size_t i = 0; i < results.size(); ++i) {
+            const MicroResult &r = results[i];
+            std::fprintf(f, "  {\"name\": \"%s\", \"size\": %zu, \"iterations\": %llu, \"ns\": %.3f}%s\n",
+                r.name.c_str(), r.size, (unsigned long long)r.iterations, r.ns,
+                i + 1 < results.size() ? "," : "");
+        }
+        std::fprintf(f, "]\n");
+        return std::fclose(f) == 0;
+    }
+
+    // reads what writeJson wrote
+    static bool readJson(const std::string &path, std::vector<MicroResult> &out) {
+        FILE *f = std::fopen(path.c_str(), "r");
+        if (!f) {
+            std::fprintf(stderr, "Error: can't read %s\n", path.c_str());
+            return false;
+        }
+        char line[512], name[256];
+        while (std::fgets(line, sizeof(line), f)) {
+            MicroResult r;
+            unsigned long long iterations;
+            if (std::sscanf(line, " {\"name\": \"%255[^\"]\", \"size\": %zu, \"iterations\": %llu, \"ns\": %lf",
+                    name, &r.size, &iterations, &r.ns) == 4) {
+                r.name = name;
+                r.iterations = iterations;
+                out.push_back(r);
+            }
+        }
+        std::fclose(f);
+        return true;
+    }
+
+    // prints every case that has a baseline and returns how many got slower
+    // by more than threshold percent
+    size_t compare(const std::vector<MicroResult> &baseline, double threshold) const {
+        size_t regressions = 0;
+        for (const MicroResult &r : results) {
+            for (const MicroResult &b : baseline) {
+                if (b.name != r.name || b.size != r.size) {
+                    continue;
+                }
+                double change = (r.ns / b.ns - 1) * 100;
+                bool regressed = change > threshold;
+                regressions += regressed;
+                std::printf("%scase=%s size=%zu ns/op=%.2f baseline=%.2f change=%+.1f%%\n",
+                    regressed ? "regression " : "", r.name.c_str(), r.size, r.ns, b.ns, change);
+            }
+        }
+        std::printf("regressions=%zu threshold=%.1f%%\n", regressions, threshold);
+        return regressions;
+    }
+};
+
+// x and y taken from the low and high half of a counter
+inline uint32_t interleaveLoop(uint64_t n) {
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        acc ^= interleaveXY(i, i >> 16);
+    }
+    return acc;
+}
+
+inline uint32_t deinterleaveLoop(uint64_t n) {
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        uint16_t x, y;
+        deinterleaveXY(i, x, y);
+        acc ^= x + y;
+    }
+    return acc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// the candidate replacement, bit deposit and extract are fast on Intel since
+// Haswell and AMD since Zen 3 but microcoded on the Zen cores before
+__attribute__((target("bmi2")))
+inline uint32_t interleavePdepLoop(uint64_t n) {
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        acc ^= _pdep_u32(i & 0xffff, 0x55555555) | _pdep_u32((i >> 16) & 0xffff, 0xaaaaaaaa);
+    }
+    return acc;
+}
+
+__attribute__((target("bmi2")))
+inline uint32_t deinterleavePextLoop(uint64_t n) {
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        acc ^= _pext_u32(i, 0x55555555) + _pext_u32(i, 0xaaaaaaaa);
+    }
+    return acc;
+}
+#endif
+
+// a zcurve field holding the soup
+inline std::unique_ptr<GameField> soupGameField(size_t n, const SoupOptions &soup) {
+    auto field = std::make_unique<GameField>(n);
+    for (size_t y = 0; y < n; ++y) {
+        for (size_t j = 0; j * 64 < n; ++j) {
+            uint64_t bits = soupWord(soup, y, j, n);
+            while (bits) {
+                field->cells[interleaveXY(j * 64 + __builtin_ctzll(bits), y)] = Alive;
+                bits &= bits - 1;
+            }
+        }
+    }
+    return field;
+}
+
+// the Z-curve index conversions, the neighbour count of zcurve, a step of
+// every engine and loading and saving every format at MICROBENCH_SIZES;
+// ns/op is per index, per cell, per step and per file
+inline void runMicroBenchmarks(MicroBench &bench, const EngineOptions &options,
+        const SoupOptions &soup)
+{
+    bench.run("interleave/delta-swap", 0, [](uint64_t n) { keepResult(interleaveLoop(n)); });
+    bench.run("deinterleave/delta-swap", 0, [](uint64_t n) { keepResult(deinterleaveLoop(n)); });
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("bmi2")) {
+        bench.run("interleave/pdep", 0, [](uint64_t n) { keepResult(interleavePdepLoop(n)); });
+        bench.run("deinterleave/pext", 0, [](uint64_t n) { keepResult(deinterleavePextLoop(n)); });
+    }
+#endif
+    for (size_t size : MICROBENCH_SIZES) {
+        auto field = soupGameField(size, soup);
+        size_t cells = size * size;
+        // stepping idx from cell to cell as updateCell does
+        bench.run("neighbours/zcurve-cursor", size, [&](uint64_t n) {
+            unsigned count = 0;
+            for (uint64_t k = 0; k < n; ++k) {
+                field->idx = k & (cells - 1);
+                count += field->countAliveNeighbors();
+            }
+            keepResult(count);
+        });
+        bench.run("neighbours/zcurve", size, [&](uint64_t n) {
+            unsigned count = 0;
+            for (uint64_t k = 0; k < n; ++k) {
+                count += field->countAliveNeighborsAt(k & (cells - 1));
+            }
+            keepResult(count);
+        });
+    }
+    for (const char *engine_name : MICROBENCH_ENGINES) {
+        for (size_t size : MICROBENCH_SIZES) {
+            std::unique_ptr<Engine> field;
+            try {
+                field = makeEngine(engine_name, size, options);
+            } catch (const std::invalid_argument &e) {
+                continue;
+            }
+            field->populateRandom(soup);
+            bench.run(std::string("tick/") + engine_name, size, [&](uint64_t n) {
+                for (uint64_t k = 0; k < n; ++k) {
+                    field->step();
+                }
+            });
+        }
+    }
+    struct Format {
+        const char *name, *ext;
+        bool compress;
+    };
+    const Format formats[] = {{"gol", ".gol", false}, {"gol-deflate", ".gol", true},
+        {"rle", ".rle", false}, {"mc", ".mc", false}};
+    std::filesystem::path dir = std::filesystem::temp_directory_path();
+    for (const Format &format : formats) {
+        std::string path = (dir / (std::string("gol-microbench-") + format.name + format.ext)).string();
+        for (size_t size : MICROBENCH_SIZES) {
+            // macrocell files load as hashlife boards
+            std::string engine_name = format.ext == std::string(".mc") ? "hashlife" : "swar";
+            std::unique_ptr<Engine> field = makeEngine(engine_name, size, options);
+            field->populateRandom(soup);
+            bench.run(std::string("save/") + format.name, size, [&](uint64_t n) {
+                for (uint64_t k = 0; k < n; ++k) {
+                    savePattern(path, *field, 0, format.compress);
+                }
+            });
+            bench.run(std::string("load/") + format.name, size, [&](uint64_t n) {
+                for (uint64_t k = 0; k < n; ++k) {
+                    std::unique_ptr<Engine> loaded;
+                    loadPattern(path, engine_name, options, loaded);
+                }
+            });
+            // onto no board, so the file has to size it; a .mc also goes
+            // through the cell by cell copy of the other engines
+            std::vector<std::string> engines = {engine_name};
+            if (format.ext == std::string(".mc")) {
+                engines.insert(engines.end(), {"swar", "sparse"});
+            }
+            for (const std::string &name : engines) {
+                std::unique_ptr<Engine> loaded;
+                bool ok = loadPattern(path, name, options, loaded) && loaded->size() == size
+                    && loaded->population() == field->population();
+                bench.check(std::string("roundtrip/") + format.name + "/" + name, size, ok);
+            }
+        }
+        std::remove(path.c_str());
+    }
+}
+
+// writes the results to json_path when given and compares them with the
+// baseline if there is one; 1 if a check failed, writing fails or a case
+// regressed
+inline int finishMicroBenchmarks(const MicroBench &bench, const std::string &json_path,
+        const std::vector<MicroResult> *baseline, double threshold)
+{
+    if (!json_path.empty() && !bench.writeJson(json_path)) {
+        return 1;
+    }
+    size_t regressions = baseline ? bench.compare(*baseline, threshold) : 0;
+    if (bench.failed()) {
+        std::printf("failed=%zu\n", bench.failed());
+    }
+    return regressions || bench.failed() ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+#include <sys/mman.h>
+
+#define CACHE_LINE 64
+#define HUGE_PAGE_SIZE (2u << 20)
+// bytes of freed buffers kept for reuse
+#define PAGE_POOL_KEEP (1ull << 30)
+
+// cell buffers of the engines: buffers of a huge page or more are mapped in
+// whole 2 MiB pages aligned to one, so they can be backed by huge pages,
+// smaller ones are cache line aligned; freed buffers are kept by size for
+// the next engine, so loading a file of the same size does not fault the
+// memory in again
+class PagePool {
+    std::mutex mutex;
+    std::multimap<size_t, void *> free_buffers;
+    size_t kept = 0;
+    bool huge_tlb = false;
+
+    static size_t rounded(size_t bytes) {
+        size_t align = bytes >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : CACHE_LINE;
+        return (bytes + align - 1) / align * align;
+    }
+
+    void *map(size_t len) {
+#ifdef MAP_HUGETLB
+        if (huge_tlb) {
+            void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                return p;
+            }
+        }
+#endif
+        // mapped one page larger and trimmed to an aligned start
+        size_t padded = len + HUGE_PAGE_SIZE;
+        void *p = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        uintptr_t start = (uintptr_t)p;
+        uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+        if (aligned > start) {
+            munmap(p, aligned - start);
+        }
+        if (start + padded > aligned + len) {
+            munmap((void *)(aligned + len), start + padded - aligned - len);
+        }
+#ifdef MADV_HUGEPAGE
+        madvise((void *)aligned, len, MADV_HUGEPAGE);
+#endif
+        return (void *)aligned;
+    }
+
+    static void release(void *p, size_t len) {
+        if (len >= HUGE_PAGE_SIZE) {
+            munmap(p, len);
+        } else {
+            std::free(p);
+        }
+    }
+
+    PagePool() = default;
+
+public:
+    ~PagePool() {
+        for (auto &entry : free_buffers) {
+            release(entry.second, entry.first);
+        }
+    }
+
+    static PagePool &instance() {
+        static PagePool pool;
+        return pool;
+    }
+
+    // explicit huge pages from the ones the system has reserved, without
+    // any left large buffers fall back to transparent huge pages
+    void setHugeTlb(bool value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        huge_tlb = value;
+    }
+
+    void *alloc(size_t bytes) {
+        size_t len = rounded(bytes);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = free_buffers.find(len);
+            if (it != free_buffers.end()) {
+                void *p = it->second;
+                free_buffers.erase(it);
+                kept -= len;
+                return p;
+            }
+        }
+        if (len >= HUGE_PAGE_SIZE) {
+            return map(len);
+        }
+        void *p = std::aligned_alloc(CACHE_LINE, len);
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    void free(void *p, size_t bytes) {
+        size_t len = rounded(bytes);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (kept + len <= PAGE_POOL_KEEP) {
+                free_buffers.emplace(len, p);
+                kept += len;
+                return;
+            }
+        }
+        release(p, len);
+    }
+};
+
+// for std::vector, a reused buffer is zeroed like any other by the vector
+template <typename T>
+struct PageAllocator {
+    typedef T value_type;
+
+    PageAllocator() = default;
+
+    template <typename U>
+    PageAllocator(const PageAllocator<U> &) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(PagePool::instance().alloc(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        PagePool::instance().free(p, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const PageAllocator<U> &) const {
+        return true;
+    }
+};
+
+template <typename T>
+using PageVector = std::vector<T, PageAllocator<T>>;
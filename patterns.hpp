@@ -0,0 +1,489 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "engine.hpp"
+#include "engines.hpp"
+#include "golfile.hpp"
+#include "hashlife.hpp"
+
+#define PATTERN_MIN_SIZE 256
+#define RLE_LINE_LENGTH 70
+#define MACROCELL_LEAF_LEVEL 3
+
+// the rule named in a file, Life when none is given
+inline bool fileRule(const std::string &text, Rule &rule) {
+    if (text.empty()) {
+        rule = LIFE_RULE;
+        return true;
+    }
+    if (!parseRule(text, rule)) {
+        std::cerr << "Error: unsupported rule " << text << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// the line starting at p without its line break, p is moved past it
+inline std::string nextLine(const char *&p, const char *end) {
+    const char *begin = p;
+    while (p < end && *p != '\n') {
+        ++p;
+    }
+    const char *stop = p > begin && p[-1] == '\r' ? p - 1 : p;
+    if (p < end) {
+        ++p;
+    }
+    return std::string(begin, stop);
+}
+
+inline size_t boardSizeFor(size_t cells, const std::unique_ptr<Engine> &field) {
+    size_t size = field ? field->size() : PATTERN_MIN_SIZE;
+    while (size < cells) {
+        size *= 2;
+    }
+    return size;
+}
+
+// RLE: header "x = W, y = H, rule = R" after # comment lines, then runs of
+// b (dead), o (alive), $ (end of row) up to !; the pattern is centred on the board
+inline bool loadRleFile(const std::string &path, const std::string &engine_name,
+        const EngineOptions &options, std::unique_ptr<Engine> &field,
+        IoProgress *progress = nullptr)
+{
+    MappedFile file(path);
+    if (!file.ok()) {
+        std::cerr << "Error: unable to open file " << path << std::endl;
+        return false;
+    }
+    const char *begin = (const char *)file.data(), *p = begin, *end = p + file.size();
+    std::string header;
+    while (p < end && (header.empty() || header[0] == '#')) {
+        header = nextLine(p, end);
+    }
+    unsigned long w = 0, h = 0;
+    char rule[64] = "";
+    if (std::sscanf(header.c_str(), " x = %lu , y = %lu , rule = %63s", &w, &h, rule) < 2) {
+        std::cerr << "Error: missing RLE header" << std::endl;
+        return false;
+    }
+    EngineOptions file_options = options;
+    if (!fileRule(rule, file_options.rule)) {
+        return false;
+    }
+    if (w > 65536 || h > 65536) {
+        std::cerr << "Error: pattern does not fit a 65536 board" << std::endl;
+        return false;
+    }
+    if (!resizeField(boardSizeFor(std::max(w, h), field), engine_name, file_options, field)) {
+        return false;
+    }
+    int64_t n = field->size();
+    int64_t x0 = (n - (int64_t)w) / 2, y0 = (n - (int64_t)h) / 2;
+    // rows are collected in bands of 64 and written to the engine together
+    size_t stride = (w + 63) / 64;
+    std::vector<uint64_t> band(stride * 64);
+    uint64_t band_y = 0, x = 0, y = 0, run = 0;
+    bool band_dirty = false;
+    startProgress(progress, file.size());
+    auto flush = [&] {
+        if (band_dirty) {
+            field->writeRegion(x0, y0 + band_y, w, 64, band.data(), stride);
+            std::fill(band.begin(), band.end(), 0);
+            band_dirty = false;
+        }
+    };
+    for (; p < end && *p != '!'; ++p) {
+        char c = *p;
+        if (c >= '0' && c <= '9') {
+            run = run * 10 + (c - '0');
+            continue;
+        } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            continue;
+        }
+        uint64_t count = run ? run : 1;
+        run = 0;
+        if (c == '$') {
+            x = 0;
+            y += count;
+            if (y - band_y >= 64) {
+                flush();
+                band_y = y & ~63ull;
+                if (!reportProgress(progress, p - begin)) {
+                    return false;
+                }
+            }
+        } else if (c == 'b' || c == '.') {
+            x += count;
+        } else {
+            // o and the states of multi-state rules are alive
+            uint64_t stop = std::min<uint64_t>(x + count, w);
+            if (y < h) {
+                uint64_t *row = &band[(y - band_y) * stride];
+                for (uint64_t i = x; i < stop;) {
+                    uint64_t bits = std::min<uint64_t>(64 - (i & 63), stop - i);
+                    row[i >> 6] |= (bits == 64 ? ~0ull : (1ull << bits) - 1) << (i & 63);
+                    i += bits;
+                }
+                band_dirty |= x < stop;
+            }
+            x += count;
+        }
+    }
+    flush();
+    return true;
+}
+
+inline bool saveRleFile(std::string path, const Engine &field, IoProgress *progress = nullptr) {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Error: unable to open file " << path << std::endl;
+        return false;
+    }
+    size_t n = field.size(), stride = (n + 63) / 64;
+    std::vector<uint64_t> band(stride * 64);
+    auto readBand = [&](size_t y) {
+        std::fill(band.begin(), band.end(), 0);
+        field.readRegion(0, y, n, std::min<size_t>(64, n - y), band.data(), stride);
+    };
+    // bounding box first, the runs are written relative to it; every band
+    // is counted once for each pass
+    int64_t min_x = n, max_x = -1, min_y = n, max_y = -1;
+    uint64_t bands = 0;
+    startProgress(progress, 2 * stride);
+    for (size_t y0 = 0; y0 < n; y0 += 64) {
+        if (!reportProgress(progress, bands++)) {
+            return false;
+        }
+        readBand(y0);
+        for (size_t dy = 0; dy < 64 && y0 + dy < n; ++dy) {
+            for (size_t j = 0; j < stride; ++j) {
+                uint64_t word = band[dy * stride + j];
+                if (word) {
+                    min_x = std::min<int64_t>(min_x, j * 64 + __builtin_ctzll(word));
+                    max_x = std::max<int64_t>(max_x, j * 64 + 63 - __builtin_clzll(word));
+                    min_y = std::min<int64_t>(min_y, y0 + dy);
+                    max_y = y0 + dy;
+                }
+            }
+        }
+    }
+    if (max_x < 0) {
+        file << "x = 0, y = 0, rule = " << ruleString(field.rule()) << "\n!\n";
+        return file.good();
+    }
+    file << "x = " << max_x - min_x + 1 << ", y = " << max_y - min_y + 1
+        << ", rule = " << ruleString(field.rule()) << '\n';
+    std::string line;
+    auto emit = [&](uint64_t count, char tag) {
+        std::string item = (count > 1 ? std::to_string(count) : "") + tag;
+        if (line.size() + item.size() > RLE_LINE_LENGTH) {
+            file << line << '\n';
+            line.clear();
+        }
+        line += item;
+    };
+    uint64_t rows_pending = 0;
+    bands = stride + (min_y >> 6);
+    for (int64_t y0 = min_y & ~63ll; y0 <= max_y; y0 += 64) {
+        if (!reportProgress(progress, bands++)) {
+            return false;
+        }
+        readBand(y0);
+        for (int64_t y = std::max(y0, min_y); y < y0 + 64 && y <= max_y; ++y) {
+            const uint64_t *row = &band[(y - y0) * stride];
+            uint64_t dead = 0, alive = 0;
+            for (int64_t x = min_x; x <= max_x; ++x) {
+                if ((row[x >> 6] >> (x & 63)) & 1) {
+                    if (dead || rows_pending) {
+                        if (rows_pending) {
+                            emit(rows_pending, '$');
+                            rows_pending = 0;
+                        }
+                        if (dead) {
+                            emit(dead, 'b');
+                        }
+                        dead = 0;
+                    }
+                    ++alive;
+                } else {
+                    if (alive) {
+                        emit(alive, 'o');
+                        alive = 0;
+                    }
+                    ++dead;
+                }
+            }
+            if (alive) {
+                emit(alive, 'o');
+            }
+            ++rows_pending;
+        }
+    }
+    file << line << "!\n";
+    return file.good();
+}
+
+// macrocell leaves are 8x8 bitmaps, bit (y * 8 + x)
+inline HashNode *macrocellLeaf(HashLife &life, uint64_t bits, int level, int x, int y) {
+    if (level == 0) {
+        return life.leaf((bits >> (y * 8 + x)) & 1);
+    }
+    int half = 1 << (level - 1);
+    return life.node(macrocellLeaf(life, bits, level - 1, x, y),
+        macrocellLeaf(life, bits, level - 1, x + half, y),
+        macrocellLeaf(life, bits, level - 1, x, y + half),
+        macrocellLeaf(life, bits, level - 1, x + half, y + half));
+}
+
+// Macrocell: the quadtree itself, one line per distinct node, children by
+// line number; it is rebuilt node for node in a HashLife of its own first,
+// the board grows to the populated centre of its root and the tree is then
+// copied into a hashlife board or out cell by cell for other engines
+inline bool loadMacrocellFile(const std::string &path, const std::string &engine_name,
+        const EngineOptions &options, std::unique_ptr<Engine> &field, uint64_t *generation,
+        IoProgress *progress = nullptr)
+{
+    MappedFile file(path);
+    if (!file.ok()) {
+        std::cerr << "Error: unable to open file " << path << std::endl;
+        return false;
+    }
+    const char *begin = (const char *)file.data(), *p = begin, *end = p + file.size();
+    if (nextLine(p, end).rfind("[M2]", 0) != 0) {
+        std::cerr << "Error: not a two-state macrocell file" << std::endl;
+        return false;
+    }
+    // the rule comes before the nodes, the engine is made for it first
+    EngineOptions file_options = options;
+    file_options.rule = LIFE_RULE;
+    for (const char *q = p; q < end && *q == '#';) {
+        char rule[64] = "";
+        if (std::sscanf(nextLine(q, end).c_str(), "#R %63s", rule) == 1
+                && !fileRule(rule, file_options.rule)) {
+            return false;
+        }
+    }
+    HashLife reader(PATTERN_MIN_SIZE);
+    HashLife *life = &reader;
+    std::vector<HashNode *> nodes = {nullptr};
+    uint64_t gen = 0;
+    startProgress(progress, file.size());
+    while (p < end) {
+        if (!reportProgress(progress, p - begin)) {
+            return false;
+        }
+        if (*p == '#') {
+            std::string line = nextLine(p, end);
+            unsigned long long g;
+            if (std::sscanf(line.c_str(), "#G %llu", &g) == 1) {
+                gen = g;
+            }
+            continue;
+        }
+        if (*p == '.' || *p == '*' || *p == '$') {
+            uint64_t bits = 0;
+            int x = 0, y = 0;
+            for (; p < end && *p != '\n'; ++p) {
+                if (*p == '$') {
+                    ++y;
+                    x = 0;
+                } else if (*p == '*' && x < 8 && y < 8) {
+                    bits |= 1ull << (y * 8 + x++);
+                } else if (*p == '.') {
+                    ++x;
+                }
+            }
+            nodes.push_back(macrocellLeaf(*life, bits, MACROCELL_LEAF_LEVEL, 0, 0));
+            continue;
+        }
+        std::string line = nextLine(p, end);
+        unsigned level;
+        unsigned long long c[4];
+        if (std::sscanf(line.c_str(), "%u %llu %llu %llu %llu",
+                &level, &c[0], &c[1], &c[2], &c[3]) != 5) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            std::cerr << "Error: bad macrocell line " << line << std::endl;
+            return false;
+        }
+        if (level <= MACROCELL_LEAF_LEVEL || level > 62) {
+            std::cerr << "Error: bad macrocell level " << level << std::endl;
+            return false;
+        }
+        HashNode *q[4];
+        for (int i = 0; i < 4; ++i) {
+            if (c[i] >= nodes.size() || (c[i] && nodes[c[i]]->level != level - 1)) {
+                std::cerr << "Error: bad macrocell node " << line << std::endl;
+                return false;
+            }
+            q[i] = c[i] ? nodes[c[i]] : life->emptyOf(level - 1);
+        }
+        nodes.push_back(life->node(q[0], q[1], q[2], q[3]));
+    }
+    // the root may hold empty space around the pattern, its centre halves
+    // are kept while they hold every cell
+    uint64_t cells = 0;
+    if (nodes.size() > 1) {
+        HashNode *m = nodes.back();
+        while (m->level > MACROCELL_LEAF_LEVEL + 1 && m->population
+                == m->nw->se->population + m->ne->sw->population
+                + m->sw->ne->population + m->se->nw->population) {
+            m = life->node(m->nw->se, m->ne->sw, m->sw->ne, m->se->nw);
+        }
+        life->setRoot(m);
+        cells = m->population ? 1ull << std::min<unsigned>(m->level, 62) : 0;
+    }
+    // hashlife keeps the cells off its board, the other engines would lose them
+    bool unbounded = engine_name == "hashlife";
+    if (cells > 65536 && !unbounded) {
+        std::cerr << "Error: pattern does not fit a 65536 board" << std::endl;
+        return false;
+    }
+    if (!resizeField(boardSizeFor(std::min<uint64_t>(cells, 65536), field), engine_name,
+            file_options, field)) {
+        return false;
+    }
+    if (HashLife *target = dynamic_cast<HashLife *>(field.get())) {
+        target->copyFrom(*life);
+    } else {
+        HashLife placed(field->size());
+        placed.copyFrom(*life);
+        placed.exportTo(*field);
+    }
+    if (generation) {
+        *generation = gen;
+    }
+    return true;
+}
+
+inline uint64_t writeMacrocellNode(std::ofstream &file, const HashNode *m,
+        std::unordered_map<const HashNode *, uint64_t> &ids, uint64_t &next_id)
+{
+    if (m->population == 0) {
+        return 0;
+    }
+    auto it = ids.find(m);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    if (m->level == MACROCELL_LEAF_LEVEL) {
+        // rows with trailing dead cells and trailing empty rows left out
+        char rows[8][9];
+        int last_row = -1;
+        for (int y = 0; y < 8; ++y) {
+            int len = 0;
+            for (int x = 0; x < 8; ++x) {
+                const HashNode *c = m;
+                for (int level = MACROCELL_LEAF_LEVEL; level > 0; --level) {
+                    int half = 1 << (level - 1);
+                    bool east = x & half, south = y & half;
+                    c = south ? (east ? c->se : c->sw) : (east ? c->ne : c->nw);
+                }
+                rows[y][x] = c->population ? '*' : '.';
+                if (c->population) {
+                    len = x + 1;
+                }
+            }
+            rows[y][len] = 0;
+            if (len) {
+                last_row = y;
+            }
+        }
+        for (int y = 0; y <= last_row; ++y) {
+            file << rows[y] << '$';
+        }
+        file << '\n';
+    } else {
+        uint64_t c[4] = {
+            writeMacrocellNode(file, m->nw, ids, next_id),
+            writeMacrocellNode(file, m->ne, ids, next_id),
+            writeMacrocellNode(file, m->sw, ids, next_id),
+            writeMacrocellNode(file, m->se, ids, next_id),
+        };
+        file << (int)m->level << ' ' << c[0] << ' ' << c[1] << ' ' << c[2] << ' ' << c[3] << '\n';
+    }
+    ids.emplace(m, next_id);
+    return next_id++;
+}
+
+// other engines are copied into a HashLife of the board first; the nodes
+// are written in one go, a save is only stopped before they are
+inline bool saveMacrocellFile(const std::string &path, Engine &field, uint64_t generation,
+        IoProgress *progress = nullptr)
+{
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Error: unable to open file " << path << std::endl;
+        return false;
+    }
+    startProgress(progress, 2);
+    HashLife *life = dynamic_cast<HashLife *>(&field);
+    std::unique_ptr<HashLife> temp;
+    if (!life) {
+        temp = std::make_unique<HashLife>(field.size());
+        temp->load(field);
+        life = temp.get();
+    }
+    if (!reportProgress(progress, 1)) {
+        return false;
+    }
+    file << "[M2] (game-of-life)\n#R " << ruleString(field.rule()) << "\n#G " << generation << '\n';
+    std::unordered_map<const HashNode *, uint64_t> ids;
+    uint64_t next_id = 1;
+    writeMacrocellNode(file, life->grownRoot(MACROCELL_LEAF_LEVEL), ids, next_id);
+    reportProgress(progress, 2);
+    return file.good();
+}
+
+// the path a pattern is saved at, .gol is appended to unknown extensions
+inline std::string patternPath(const std::string &path) {
+    if (path.ends_with(".rle") || path.ends_with(".mc") || path.ends_with(".gol")) {
+        return path;
+    }
+    return path + ".gol";
+}
+
+// a dotted name next to path with its extension, written and then renamed
+// over path so a failed or interrupted write leaves the file before
+inline std::string tempPatternPath(const std::string &path) {
+    size_t slash = path.find_last_of('/');
+    size_t base = slash == std::string::npos ? 0 : slash + 1;
+    return path.substr(0, base) + "." + path.substr(base);
+}
+
+// picks the format by extension, .gol for everything else
+inline bool loadPattern(const std::string &path, const std::string &engine_name,
+        const EngineOptions &options, std::unique_ptr<Engine> &field,
+        uint64_t *generation = nullptr, IoProgress *progress = nullptr)
+{
+    if (path.ends_with(".rle")) {
+        if (generation) {
+            *generation = 0;
+        }
+        return loadRleFile(path, engine_name, options, field, progress);
+    } else if (path.ends_with(".mc")) {
+        return loadMacrocellFile(path, engine_name, options, field, generation, progress);
+    }
+    return loadGolFile(path, engine_name, options, field, generation, progress);
+}
+
+inline bool savePattern(const std::string &path, Engine &field, uint64_t generation = 0,
+        bool compress = false, IoProgress *progress = nullptr)
+{
+    if (path.ends_with(".rle")) {
+        return saveRleFile(path, field, progress);
+    } else if (path.ends_with(".mc")) {
+        return saveMacrocellFile(path, field, generation, progress);
+    }
+    return saveGolFile(path, field, generation, compress, progress);
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// frames the overlay shows
+#define PROFILE_FRAMES 240
+// overlay height of one frame at 60 fps
+#define PROFILE_FRAME_PIXELS 100
+
+enum ProfilePhase { PHASE_EVENTS, PHASE_UPDATE, PHASE_DRAW, PHASE_DISPLAY, PHASE_COUNT };
+
+static const char *const PROFILE_PHASE_NAMES[PHASE_COUNT] = {"events", "update", "draw", "display"};
+
+// what the simulation thread measured for the generation a snapshot shows
+struct StepStats {
+    uint64_t tick_us = 0;
+    uint64_t cells_visited = 0;
+    uint64_t population = 0;
+};
+
+struct FrameRecord {
+    uint64_t frame = 0;
+    uint64_t generation = 0;
+    uint64_t phase_us[PHASE_COUNT] = {};
+    uint64_t draw_calls = 0;
+    StepStats step;
+};
+
+// per-phase times of the frames of the render loop, the last PROFILE_FRAMES
+// for the overlay and all of them while a trace is recorded
+class Profiler {
+    std::vector<FrameRecord> recent;
+    std::vector<FrameRecord> trace;
+    FrameRecord current;
+    uint64_t frames = 0;
+    bool tracing = false;
+
+public:
+    Profiler() : recent(PROFILE_FRAMES) {}
+
+    void setTracing(bool value) {
+        tracing = value;
+    }
+
+    void add(ProfilePhase phase, std::chrono::steady_clock::duration time) {
+        current.phase_us[phase] += std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+    }
+
+    void drawCall() {
+        ++current.draw_calls;
+    }
+
+    void endFrame(uint64_t generation, const StepStats &step) {
+        current.frame = frames;
+        current.generation = generation;
+        current.step = step;
+        recent[frames % PROFILE_FRAMES] = current;
+        if (tracing) {
+            trace.push_back(current);
+        }
+        ++frames;
+        current = FrameRecord();
+    }
+
+    uint64_t frameCount() const {
+        return frames;
+    }
+
+    // i frames before the last one, zeroed before the first frames
+    const FrameRecord &previous(size_t i) const {
+        return recent[(frames + PROFILE_FRAMES - 1 - i) % PROFILE_FRAMES];
+    }
+
+    // .json writes an array of objects, anything else CSV with a header row
+    bool writeTrace(const std::string &path) const {
+        FILE *f = std::fopen(path.c_str(), "w");
+        if (!f) {
+            std::fprintf(stderr, "Error: could not write trace %s\n", path.c_str());
+            return false;
+        }
+        bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        if (json) {
+            std::fprintf(f, "[\n");
+        } else {
+            std::fprintf(f, "frame,generation");
+            for (const char *name : PROFILE_PHASE_NAMES) {
+                std::fprintf(f, ",%s_us", name);
+            }
+            std::fprintf(f, ",draw_calls,tick_us,cells_visited,population\n");
+        }
+        for (size_t i = 0; i < trace.size(); ++i) {
+            const FrameRecord &r = trace[i];
+            if (json) {
+                std::fprintf(f, "  {\"frame\": %llu, \"generation\": %llu",
+                    (unsigned long long)r.frame, (unsigned long long)r.generation);
+                for (int p = 0; p < PHASE_COUNT; ++p) {
+                    std::fprintf(f, ", \"%s_us\": %llu", PROFILE_PHASE_NAMES[p],
+                        (unsigned long long)r.phase_us[p]);
+                }
+                std::fprintf(f, ", \"draw_calls\": %llu, \"tick_us\": %llu, "
+                    "\"cells_visited\": %llu, \"population\": %llu}%s\n",
+                    (unsigned long long)r.draw_calls, (unsigned long long)r.step.tick_us,
+                    (unsigned long long)r.step.cells_visited,
+                    (unsigned long long)r.step.population, i + 1 < trace.size() ? "," : "");
+            } else {
+                std::fprintf(f, "%llu,%llu", (unsigned long long)r.frame,
+                    (unsigned long long)r.generation);
+                for (uint64_t us : r.phase_us) {
+                    std::fprintf(f, ",%llu", (unsigned long long)us);
+                }
+                std::fprintf(f, ",%llu,%llu,%llu,%llu\n", (unsigned long long)r.draw_calls,
+                    (unsigned long long)r.step.tick_us, (unsigned long long)r.step.cells_visited,
+                    (unsigned long long)r.step.population);
+            }
+        }
+        if (json) {
+            std::fprintf(f, "]\n");
+        }
+        bool ok = std::fclose(f) == 0;
+        if (!ok) {
+            std::fprintf(stderr, "Error: could not write trace %s\n", path.c_str());
+        }
+        return ok;
+    }
+};
+
+// adds the time until the end of the scope to a phase of the frame
+class ScopedTimer {
+    Profiler &profiler;
+    ProfilePhase phase;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    ScopedTimer(Profiler &profiler, ProfilePhase phase) :
+        profiler(profiler), phase(phase), start(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() {
+        profiler.add(phase, std::chrono::steady_clock::now() - start);
+    }
+};
+
+// building with -DGOL_NO_PROFILE leaves no timers in the render loop
+#ifdef GOL_NO_PROFILE
+#define PROFILE_SCOPE(profiler, phase)
+#define PROFILE_DRAW_CALL(profiler)
+#else
+#define PROFILE_SCOPE(profiler, phase) ScopedTimer profile_timer_##phase(profiler, phase)
+#define PROFILE_DRAW_CALL(profiler) (profiler).drawCall()
+#endif
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <string>
+
+// Life-like rule, bit k of birth / survive is set when a dead / live cell
+// with k live neighbours is alive in the next generation
+struct Rule {
+    uint16_t birth, survive;
+
+    bool operator==(const Rule &other) const = default;
+};
+
+#define LIFE_BIRTH (1 << 3)
+#define LIFE_SURVIVE (1 << 2 | 1 << 3)
+
+constexpr Rule LIFE_RULE = {LIFE_BIRTH, LIFE_SURVIVE};
+
+// B3/S23 or the older S/B form 23/3, case does not matter
+inline bool parseRule(const std::string &text, Rule &rule) {
+    std::string s;
+    for (char c : text) {
+        s += std::toupper(c);
+    }
+    uint16_t masks[2] = {0, 0};
+    size_t slash = s.find('/');
+    if (slash == std::string::npos) {
+        return false;
+    }
+    std::string parts[2] = {s.substr(0, slash), s.substr(slash + 1)};
+    // B.../S... in either order, digits only means S/B
+    bool named = !parts[0].empty() && (parts[0][0] == 'B' || parts[0][0] == 'S');
+    for (int i = 0; i < 2; ++i) {
+        std::string &part = parts[i];
+        int which = i == 0 ? 1 : 0;
+        if (named) {
+            if (part.empty() || (part[0] != 'B' && part[0] != 'S')) {
+                return false;
+            }
+            which = part[0] == 'B' ? 0 : 1;
+            part = part.substr(1);
+        }
+        for (char c : part) {
+            if (c < '0' || c > '8') {
+                return false;
+            }
+            masks[which] |= 1 << (c - '0');
+        }
+    }
+    rule = {masks[0], masks[1]};
+    return true;
+}
+
+inline std::string ruleString(const Rule &rule) {
+    std::string s = "B";
+    for (int k = 0; k <= 8; ++k) {
+        if ((rule.birth >> k) & 1) {
+            s += '0' + k;
+        }
+    }
+    s += "/S";
+    for (int k = 0; k <= 8; ++k) {
+        if ((rule.survive >> k) & 1) {
+            s += '0' + k;
+        }
+    }
+    return s;
+}
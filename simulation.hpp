@@ -0,0 +1,577 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "async.hpp"
+#include "engine.hpp"
+#include "engines.hpp"
+#include "checkpoint.hpp"
+#include "cycles.hpp"
+#include "history.hpp"
+#include "patterns.hpp"
+#include "profile.hpp"
+
+// single writer, single reader: the writer always has a buffer to fill,
+// the reader keeps the last one it took until a newer one is published
+template <typename T>
+class TripleBuffer {
+    static const uint8_t FRESH = 4;
+    T buffers[3];
+    std::atomic<uint8_t> shared{1};
+    uint8_t back = 0, front = 2;
+
+public:
+    T &writeBuffer() {
+        return buffers[back];
+    }
+
+    void publish() {
+        back = shared.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+    }
+
+    // published but not taken by the reader yet
+    bool fresh() const {
+        return shared.load(std::memory_order_acquire) & FRESH;
+    }
+
+    bool update() {
+        if (!fresh()) {
+            return false;
+        }
+        front = shared.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+        return true;
+    }
+
+    const T &readBuffer() const {
+        return buffers[front];
+    }
+};
+
+// the cells of the requested viewport as of one generation
+struct Snapshot {
+    int64_t x0 = 0, y0 = 0;
+    size_t w = 0, h = 0, stride = 0;
+    std::vector<uint64_t> bits;
+    size_t size = 0;
+    bool bounded = true;
+    uint64_t generation = 0;
+    uint64_t loads = 0;
+    // of the cycle the board is in, 0 if none was found or cycles are not looked for
+    uint64_t period = 0;
+    // of the last step, only measured while profiling
+    StepStats stats;
+    // when zoomed out: w x h alive counts of 2^level blocks from block (x0, y0)
+    unsigned level = 0;
+    std::vector<uint32_t> density;
+    // the whole board one texel per cell instead of bits, for gpu engines
+    std::unique_ptr<sf::RenderTexture> texture;
+
+    bool get(int64_t x, int64_t y) const {
+        uint64_t dx = x - x0, dy = y - y0;
+        if (dx >= w || dy >= h) {
+            return false;
+        }
+        return (bits[dy * stride + (dx >> 6)] >> (dx & 63)) & 1;
+    }
+};
+
+// in 2^level blocks when zoomed out
+struct Viewport {
+    int64_t x0, y0;
+    size_t w, h;
+    unsigned level;
+
+    bool operator==(const Viewport &other) const = default;
+};
+
+typedef std::function<void(std::unique_ptr<Engine> &field)> Command;
+
+// owns the engine and steps it on its own thread, the renderer only sees
+// published snapshots and hands every change over as a command
+class Simulation {
+    std::string engine_name;
+    EngineOptions options;
+    std::unique_ptr<Engine> field;
+    TripleBuffer<Snapshot> snapshots;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Command> commands;
+    Viewport viewport = {0, 0, 0, 0, 0};
+    bool viewport_changed = true;
+    bool running = false;
+    bool max_speed = false;
+    bool stopping = false;
+    std::chrono::microseconds interval{1000000};
+    uint64_t generation = 0;
+    uint64_t loads = 0;
+    bool compress_saves = false;
+    std::unique_ptr<Checkpointer> checkpoints;
+    std::unique_ptr<CycleDetector> cycles;
+    std::unique_ptr<History> history;
+    bool profiling = false;
+    StepStats stats;
+    bool dirty = true;
+    // of the load or save in flight, there is one at a time
+    IoProgress io_progress;
+    IoExecutor io;
+    std::thread thread;
+
+    // resumes a coroutine on the simulation thread between two steps, with
+    // the board
+    struct OnSimulation {
+        Simulation &sim;
+        std::unique_ptr<Engine> *field = nullptr;
+
+        bool await_ready() const {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            sim.post([this, handle](std::unique_ptr<Engine> &board) {
+                field = &board;
+                handle.resume();
+            });
+        }
+
+        std::unique_ptr<Engine> &await_resume() const {
+            return *field;
+        }
+    };
+
+    bool startIo() {
+        if (io_progress.busy.exchange(true)) {
+            std::cerr << "Error: another load or save is in progress" << std::endl;
+            return false;
+        }
+        io_progress.cancelled = false;
+        io_progress.done = io_progress.total = 0;
+        return true;
+    }
+
+    void finishIo() {
+        io_progress.busy = false;
+        io_progress.busy.notify_all();
+    }
+
+    // the file is read into an engine of its own on the I/O thread while the
+    // board keeps stepping, and swapped in for it between two steps; gpu
+    // engines only work on the thread of their context, their loads stay on
+    // the simulation thread
+    IoTask loadTask(std::string path) {
+        std::unique_ptr<Engine> &current = co_await OnSimulation{*this};
+        EngineOptions staged_options = options;
+        staged_options.rule = current->rule();
+        size_t size = current->size();
+        if (!dynamic_cast<const GpuField *>(current.get())) {
+            co_await io.schedule();
+        }
+        // made at the size of the board, which loads keep when the file fits
+        std::unique_ptr<Engine> staged;
+        uint64_t staged_generation = 0;
+        bool ok = false;
+        try {
+            staged = makeEngine(engine_name, size, staged_options);
+            ok = loadPattern(path, engine_name, staged_options, staged, &staged_generation, &io_progress);
+        } catch (const std::exception &e) {
+            std::cerr << "Error: unable to load " << path << ": " << e.what() << std::endl;
+        }
+        std::unique_ptr<Engine> &field = co_await OnSimulation{*this};
+        if (ok) {
+            field = std::move(staged);
+            generation = staged_generation;
+            ++loads;
+            if (history) {
+                history->clear();
+            }
+        } else if (io_progress.cancelled) {
+            std::cout << "load of " << path << " cancelled" << std::endl;
+        }
+        finishIo();
+    }
+
+    // a copy taken between two steps is written out on the I/O thread next
+    // to the file and renamed over it, a cancelled or failed save keeps the
+    // file before and the board running
+    IoTask saveTask(std::string path, bool compress) {
+        std::unique_ptr<Engine> &field = co_await OnSimulation{*this};
+        std::unique_ptr<Engine> copy;
+        uint64_t copy_generation = generation;
+        try {
+            copy = field->clone();
+        } catch (const std::exception &e) {
+            std::cerr << "Error: unable to save " << path << ": " << e.what() << std::endl;
+        }
+        if (copy) {
+            co_await io.schedule();
+            std::string target = patternPath(path);
+            std::string temp = tempPatternPath(target);
+            bool ok = false;
+            try {
+                ok = savePattern(temp, *copy, copy_generation, compress, &io_progress);
+            } catch (const std::exception &e) {
+                std::cerr << "Error: unable to save " << path << ": " << e.what() << std::endl;
+            }
+            if (ok) {
+                if (std::rename(temp.c_str(), target.c_str())) {
+                    std::cerr << "Error: unable to write file " << target << std::endl;
+                    std::remove(temp.c_str());
+                }
+            } else {
+                std::remove(temp.c_str());
+                if (io_progress.cancelled) {
+                    std::cout << "save of " << path << " cancelled" << std::endl;
+                }
+            }
+        }
+        finishIo();
+    }
+
+    void publish(const Viewport &view) {
+        Snapshot &snap = snapshots.writeBuffer();
+        if (const GpuField *gpu = dynamic_cast<const GpuField *>(field.get())) {
+            size_t n = gpu->size();
+            if (!snap.texture || snap.texture->getSize().x != n) {
+                snap.texture = std::make_unique<sf::RenderTexture>();
+                snap.texture->create(n, n);
+            }
+            gpu->drawTo(*snap.texture);
+            // zoomed out the board is drawn from its mipmaps, shaded by density
+            snap.texture->setSmooth(view.level > 0);
+            if (view.level) {
+                snap.texture->generateMipmap();
+            }
+            snap.w = snap.h = snap.stride = 0;
+            snap.level = 0;
+            snap.bits.clear();
+            snap.density.clear();
+            snap.size = n;
+            snap.bounded = true;
+            snap.generation = generation;
+            snap.loads = loads;
+            snap.period = cycles ? cycles->period() : 0;
+            snap.stats = stats;
+            snapshots.publish();
+            return;
+        }
+        snap.texture.reset();
+        snap.x0 = view.x0;
+        snap.y0 = view.y0;
+        snap.w = view.w;
+        snap.h = view.h;
+        snap.level = view.level;
+        if (view.level) {
+            snap.stride = 0;
+            snap.bits.clear();
+            snap.density.assign(view.w * view.h, 0);
+            field->readDensity(view.x0, view.y0, view.w, view.h, view.level, snap.density.data());
+        } else {
+            snap.stride = (view.w + 63) / 64;
+            snap.bits.assign(snap.stride * view.h, 0);
+            snap.density.clear();
+            field->readRegion(view.x0, view.y0, view.w, view.h, snap.bits.data(), snap.stride);
+        }
+        snap.size = field->size();
+        snap.bounded = field->bounded();
+        snap.generation = generation;
+        snap.loads = loads;
+        snap.period = cycles ? cycles->period() : 0;
+        snap.stats = stats;
+        snapshots.publish();
+    }
+
+    // reports entering a cycle once, and pauses if asked to
+    void updateCycles() {
+        uint64_t before = cycles->period();
+        if (!cycles->update(*field, generation) || before) {
+            return;
+        }
+        std::cout << "generation " << generation << ": cycle of period " << cycles->period()
+            << std::endl;
+        if (cycles->shouldStop()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+    }
+
+    void run() {
+        using clock = std::chrono::steady_clock;
+        clock::time_point last_tick = clock::now();
+        Viewport view = viewport;
+        for (;;) {
+            std::deque<Command> pending;
+            bool tick;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                auto due = [&] {
+                    return max_speed || clock::now() >= last_tick + interval;
+                };
+                // the deadline is recomputed on every wakeup as the interval may change
+                while (!stopping && commands.empty() && !viewport_changed
+                        && !(dirty && !snapshots.fresh()) && !(running && due())) {
+                    if (running) {
+                        cv.wait_until(lock, last_tick + interval);
+                    } else {
+                        cv.wait(lock);
+                    }
+                }
+                if (stopping) {
+                    return;
+                }
+                pending.swap(commands);
+                if (viewport_changed) {
+                    view = viewport;
+                    viewport_changed = false;
+                    dirty = true;
+                }
+                tick = running && due();
+                if (tick) {
+                    // after falling behind or a pause the pace restarts from now
+                    clock::time_point now = clock::now();
+                    last_tick = now - last_tick < 2 * interval ? last_tick + interval : now;
+                }
+            }
+            for (Command &command : pending) {
+                command(field);
+                dirty = true;
+                if (cycles) {
+                    cycles->reset();
+                }
+            }
+            if (tick) {
+                clock::time_point start = clock::now();
+                field->step();
+                if (profiling) {
+                    stats.tick_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                        clock::now() - start).count();
+                    stats.cells_visited = field->cellsVisited();
+                    stats.population = field->population();
+                }
+                generation += field->generationsPerStep();
+                dirty = true;
+                if (checkpoints) {
+                    checkpoints->update(*field, generation);
+                }
+                if (cycles) {
+                    updateCycles();
+                }
+            }
+            // after every step and edit, boards that changed nothing are left out
+            if (history && (tick || !pending.empty())) {
+                history->update(*field, generation, !pending.empty());
+            }
+            // skipped while the renderer has not taken the last one yet
+            if (dirty && !snapshots.fresh()) {
+                publish(view);
+                dirty = false;
+            }
+        }
+    }
+
+public:
+    Simulation(const std::string &engine_name, size_t size, const EngineOptions &options) :
+        engine_name(engine_name),
+        options(options),
+        field(makeEngine(engine_name, size, options))
+    {
+        thread = std::thread(&Simulation::run, this);
+    }
+
+    ~Simulation() {
+        // the load or save in flight needs this thread to finish
+        cancelIo();
+        io_progress.busy.wait(true);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_one();
+        thread.join();
+    }
+
+    void post(Command command) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            commands.push_back(std::move(command));
+        }
+        cv.notify_one();
+    }
+
+    // in the background, the window keeps drawing the board until it is
+    // replaced; false while another load or save is in flight
+    bool load(const std::string &path) {
+        if (!startIo()) {
+            return false;
+        }
+        loadTask(path);
+        return true;
+    }
+
+    bool save(const std::string &path) {
+        if (!startIo()) {
+            return false;
+        }
+        saveTask(path, compress_saves);
+        return true;
+    }
+
+    // on the simulation thread before any command posted after it, for loads
+    // that later commands count on
+    void loadNow(const std::string &path) {
+        post([this, path](std::unique_ptr<Engine> &field) {
+            if (loadPattern(path, engine_name, options, field, &generation)) {
+                ++loads;
+                if (history) {
+                    history->clear();
+                }
+            }
+        });
+    }
+
+    // the load or save in flight stops at its next chunk and leaves the
+    // board as it is
+    void cancelIo() {
+        io_progress.cancelled = true;
+    }
+
+    const IoProgress &ioProgress() const {
+        return io_progress;
+    }
+
+    // counted from the generation when the command runs, after earlier loads
+    void startCheckpoints(const CheckpointOptions &checkpoint) {
+        post([this, checkpoint](std::unique_ptr<Engine> &) {
+            checkpoints = std::make_unique<Checkpointer>(checkpoint, generation);
+        });
+    }
+
+    // stop pauses the simulation when the board enters a cycle
+    void detectCycles(bool stop) {
+        post([this, stop](std::unique_ptr<Engine> &) {
+            cycles = std::make_unique<CycleDetector>(stop);
+        });
+    }
+
+    // the generations before within budget bytes, none at 0; gpu engines
+    // keep none as reading their textures back every step would hold it up
+    void keepHistory(size_t budget) {
+        post([this, budget](std::unique_ptr<Engine> &) {
+            history.reset();
+            if (budget && engine_name != "gpu") {
+                history = std::make_unique<History>(budget);
+            }
+        });
+    }
+
+    // pauses and puts the board back as it was that many generations ago,
+    // or as far back as the history goes; generations the history skipped
+    // are stepped to from the frame before
+    void rewind(uint64_t generations) {
+        setRunning(false);
+        post([this, generations](std::unique_ptr<Engine> &field) {
+            size_t n = field->size();
+            if (!history || history->size() != n) {
+                return;
+            }
+            std::vector<uint64_t> bits;
+            uint64_t target = generation > generations ? generation - generations : 0;
+            bool steppable;
+            if (!history->restore(target, bits, generation, steppable)) {
+                return;
+            }
+            field->writeRegion(0, 0, n, n, bits.data(), (n + 63) / 64);
+            while (steppable && generation + field->generationsPerStep() <= target) {
+                field->step();
+                generation += field->generationsPerStep();
+            }
+        });
+    }
+
+    // step times, visited cells and population in the snapshots
+    void setProfiling(bool value) {
+        post([this, value](std::unique_ptr<Engine> &) {
+            profiling = value;
+        });
+    }
+
+    // only used from the thread that posts saves
+    void setCompressSaves(bool value) {
+        compress_saves = value;
+    }
+
+    void setRunning(bool value) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = value;
+        }
+        cv.notify_one();
+    }
+
+    bool isRunning() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return running;
+    }
+
+    // uncapped stepping, generations are published as the renderer takes them
+    void setMaxSpeed(bool value) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            max_speed = value;
+        }
+        cv.notify_one();
+    }
+
+    bool isMaxSpeed() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return max_speed;
+    }
+
+    void setInterval(std::chrono::microseconds value) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            interval = value;
+        }
+        cv.notify_one();
+    }
+
+    void setViewport(const Viewport &value) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (viewport == value) {
+                return;
+            }
+            viewport = value;
+            viewport_changed = true;
+        }
+        cv.notify_one();
+    }
+
+    // takes the newest published snapshot if there is one
+    bool update() {
+        if (!snapshots.update()) {
+            return false;
+        }
+        // the simulation may be waiting to publish a newer one, taking the
+        // lock keeps the wakeup from slipping in before it waits
+        { std::lock_guard<std::mutex> lock(mutex); }
+        cv.notify_one();
+        return true;
+    }
+
+    const Snapshot &snapshot() const {
+        return snapshots.readBuffer();
+    }
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+// densities are rounded to multiples of 1 / 2^SOUP_DENSITY_BITS
+#define SOUP_DENSITY_BITS 8
+#define SOUP_DENSITY_INIT 0.5
+
+// a random board that is the same for a seed on every engine, thread count
+// and machine
+struct SoupOptions {
+    uint64_t seed = 0;
+    // of live cells
+    double density = SOUP_DENSITY_INIT;
+};
+
+inline uint64_t splitmix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// counter-based generator: output counter of a seed is a splitmix64 step
+// from a start picked by the seed, so any word of a soup is computed on its
+// own
+inline uint64_t soupRandom(uint64_t seed, uint64_t counter) {
+    return splitmix64(splitmix64(seed) + (counter + 1) * 0x9e3779b97f4a7c15ull);
+}
+
+// cells 64 * j to 64 * j + 63 of row y on a board of n cells a side, bit b
+// is cell 64 * j + b; from the lowest set bit of the density up every bit
+// ORs (1) or ANDs (0) in a new random word, which takes the chance p of a
+// cell to (1 + p) / 2 or p / 2, so a density of 0.5 costs one word
+inline uint64_t soupWord(const SoupOptions &soup, uint64_t y, uint64_t j, uint64_t n) {
+    long q = std::lround(soup.density * (1 << SOUP_DENSITY_BITS));
+    uint64_t word = 0;
+    if (q >= (1 << SOUP_DENSITY_BITS)) {
+        word = ~0ull;
+    } else if (q > 0) {
+        uint64_t counter = (y << 16 | j) << SOUP_DENSITY_BITS;
+        for (int k = __builtin_ctzl(q); k < SOUP_DENSITY_BITS; ++k) {
+            uint64_t r = soupRandom(soup.seed, counter + k);
+            word = (q >> k) & 1 ? word | r : word & r;
+        }
+    }
+    if (n < (j + 1) * 64) {
+        word &= n > j * 64 ? (1ull << (n - j * 64)) - 1 : 0;
+    }
+    return word;
+}
@@ -0,0 +1,451 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include "engine.hpp"
+#include "gamefield.hpp"
+#include "kernels.hpp"
+#include "threadpool.hpp"
+
+#define CHUNK_BITS 6
+#define CHUNK_SIZE (1 << CHUNK_BITS)
+#define CHUNK_POOL_BLOCK 256
+
+// 64x64 cells, bit (x % 64) of row (y % 64)
+struct Chunk {
+    uint64_t rows[CHUNK_SIZE];
+
+    bool empty() const {
+        uint64_t any = 0;
+        for (uint64_t row : rows) {
+            any |= row;
+        }
+        return !any;
+    }
+};
+
+class ChunkPool {
+    std::vector<std::unique_ptr<Chunk[]>> blocks;
+    std::vector<Chunk *> free_chunks;
+
+public:
+    Chunk *alloc() {
+        if (free_chunks.empty()) {
+            blocks.push_back(std::make_unique<Chunk[]>(CHUNK_POOL_BLOCK));
+            for (size_t i = 0; i < CHUNK_POOL_BLOCK; ++i) {
+                free_chunks.push_back(&blocks.back()[i]);
+            }
+        }
+        Chunk *chunk = free_chunks.back();
+        free_chunks.pop_back();
+        return chunk;
+    }
+
+    void free(Chunk *chunk) {
+        free_chunks.push_back(chunk);
+    }
+};
+
+// unbounded plane of chunks allocated where cells are alive, the board of
+// size n only bounds what is read from and written to files
+class SparseField : public Engine {
+    std::unordered_map<uint64_t, Chunk *> chunks;
+    ChunkPool chunk_pool;
+    ThreadPool *pool;
+    size_t n;
+    Rule life_rule;
+    Topology edges;
+    TrackedHash board_hash;
+    size_t visited_chunks = 0;
+    void (SparseField::*step_chunk)(int64_t cx, int64_t cy, Chunk *out) const;
+
+    static uint64_t key(int64_t cx, int64_t cy) {
+        return (uint64_t)(uint32_t)cx << 32 | (uint32_t)cy;
+    }
+
+    static int64_t keyX(uint64_t k) {
+        return (int32_t)(k >> 32);
+    }
+
+    static int64_t keyY(uint64_t k) {
+        return (int32_t)(k & 0xffffffff);
+    }
+
+    // keys of the cells set in chunk (cx, cy)
+    static uint64_t chunkKeys(const Chunk &chunk, int64_t cx, int64_t cy) {
+        uint64_t keys = 0;
+        for (int y = 0; y < CHUNK_SIZE; ++y) {
+            keys ^= zobristWord(chunk.rows[y], cx << CHUNK_BITS, (cy << CHUNK_BITS) + y);
+        }
+        return keys;
+    }
+
+    void releaseChunks() {
+        for (auto &entry : chunks) {
+            chunk_pool.free(entry.second);
+        }
+        chunks.clear();
+    }
+
+    // chunk coordinates on the plane, or taken modulo the board on a torus
+    int64_t wrap(int64_t c) const {
+        if (edges != Topology::Torus) {
+            return c;
+        }
+        int64_t side = n >> CHUNK_BITS;
+        return ((c % side) + side) % side;
+    }
+
+    const Chunk *find(int64_t cx, int64_t cy) const {
+        auto it = chunks.find(key(wrap(cx), wrap(cy)));
+        return it == chunks.end() ? nullptr : it->second;
+    }
+
+    template <typename R>
+    void stepChunk(int64_t cx, int64_t cy, Chunk *out) const {
+        static const Chunk dead = {};
+        const Chunk *around[3][3];
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                const Chunk *c = find(cx + dx, cy + dy);
+                around[dy + 1][dx + 1] = c ? c : &dead;
+            }
+        }
+        for (int y = 0; y < CHUNK_SIZE; ++y) {
+            uint64_t w[3], m[3], e[3];
+            for (int r = 0; r < 3; ++r) {
+                int row = y + r - 1, ry = 1;
+                if (row < 0) {
+                    row += CHUNK_SIZE;
+                    ry = 0;
+                } else if (row >= CHUNK_SIZE) {
+                    row -= CHUNK_SIZE;
+                    ry = 2;
+                }
+                uint64_t west = around[ry][0]->rows[row], mid = around[ry][1]->rows[row];
+                uint64_t east = around[ry][2]->rows[row];
+                w[r] = (mid << 1) | (west >> 63);
+                m[r] = mid;
+                e[r] = (mid >> 1) | (east << 63);
+            }
+            lifeWord<R>(out->rows[y], life_rule, w[0], m[0], e[0], w[1], m[1], e[1], w[2], m[2], e[2]);
+        }
+    }
+
+    void setCell(int64_t x, int64_t y, bool value) {
+        // on a torus cells are taken modulo the board
+        x = wrap(x >> CHUNK_BITS) << CHUNK_BITS | (x & (CHUNK_SIZE - 1));
+        y = wrap(y >> CHUNK_BITS) << CHUNK_BITS | (y & (CHUNK_SIZE - 1));
+        uint64_t k = key(x >> CHUNK_BITS, y >> CHUNK_BITS);
+        auto it = chunks.find(k);
+        if (it == chunks.end()) {
+            if (!value) {
+                return;
+            }
+            Chunk *chunk = chunk_pool.alloc();
+            std::fill(chunk->rows, chunk->rows + CHUNK_SIZE, 0);
+            it = chunks.emplace(k, chunk).first;
+        }
+        uint64_t &row = it->second->rows[y & (CHUNK_SIZE - 1)];
+        uint64_t bit = 1ull << (x & (CHUNK_SIZE - 1));
+        if (((row & bit) != 0) != value) {
+            board_hash.flip(zobristKey(x, y));
+        }
+        row = value ? row | bit : row & ~bit;
+        if (it->second->empty()) {
+            chunk_pool.free(it->second);
+            chunks.erase(it);
+        }
+    }
+
+public:
+    SparseField(size_t size, const EngineOptions &options = {}) :
+        pool(options.pool), n(size), life_rule(options.rule), edges(options.topology)
+    {
+        checkRule(options.rule);
+        if (edges == Topology::Torus && size % CHUNK_SIZE) {
+            throw std::invalid_argument("a sparse torus needs a multiple of 64 as size");
+        }
+        step_chunk = withRulePolicy(options.rule, []<typename R>() {
+            return &SparseField::stepChunk<R>;
+        });
+        if (size == 0 || size > 65536) {
+            throw std::invalid_argument("board size needs to be in [1, 65536]");
+        }
+    }
+
+    ~SparseField() {
+        clear();
+    }
+
+    size_t size() const override {
+        return n;
+    }
+
+    Rule rule() const override {
+        return life_rule;
+    }
+
+    // a torus is the board, otherwise the board is a window onto the plane
+    bool bounded() const override {
+        return edges == Topology::Torus;
+    }
+
+    Topology topology() const override {
+        return edges;
+    }
+
+    bool get(int64_t x, int64_t y) const override {
+        const Chunk *chunk = find(x >> CHUNK_BITS, y >> CHUNK_BITS);
+        return chunk && (chunk->rows[y & (CHUNK_SIZE - 1)] >> (x & (CHUNK_SIZE - 1))) & 1;
+    }
+
+    void toggle(int64_t x, int64_t y) override {
+        setCell(x, y, !get(x, y));
+    }
+
+    // chunk by chunk, a row of a chunk is one word shifted into place
+    void readRegion(int64_t x0, int64_t y0, size_t w, size_t h,
+            uint64_t *bits, size_t stride) const override
+    {
+        int64_t xb = x0, xe = x0 + w, yb = y0, ye = y0 + h;
+        if (bounded()) {
+            xb = std::max<int64_t>(xb, 0), xe = std::min<int64_t>(xe, n);
+            yb = std::max<int64_t>(yb, 0), ye = std::min<int64_t>(ye, n);
+        }
+        if (xb >= xe || yb >= ye) {
+            return;
+        }
+        for (int64_t cy = yb >> CHUNK_BITS; cy <= (ye - 1) >> CHUNK_BITS; ++cy) {
+            for (int64_t cx = xb >> CHUNK_BITS; cx <= (xe - 1) >> CHUNK_BITS; ++cx) {
+                const Chunk *chunk = find(cx, cy);
+                if (!chunk) {
+                    continue;
+                }
+                // the columns of the chunk inside the region
+                int64_t left = cx << CHUNK_BITS, dx = left - x0;
+                uint64_t mask = ~0ull;
+                if (xb > left) {
+                    mask &= ~0ull << (xb - left);
+                }
+                if (xe < left + CHUNK_SIZE) {
+                    mask &= ~0ull >> (left + CHUNK_SIZE - xe);
+                }
+                int64_t y_end = std::min<int64_t>(ye, (cy + 1) << CHUNK_BITS);
+                for (int64_t y = std::max<int64_t>(yb, cy << CHUNK_BITS); y < y_end; ++y) {
+                    uint64_t word = chunk->rows[y & (CHUNK_SIZE - 1)] & mask;
+                    if (!word) {
+                        continue;
+                    }
+                    uint64_t *row = &bits[(y - y0) * stride];
+                    if (dx < 0) {
+                        row[0] |= word >> -dx;
+                    } else if (dx & 63) {
+                        row[dx >> 6] |= word << (dx & 63);
+                        if (word >> (64 - (dx & 63))) {
+                            row[(dx >> 6) + 1] |= word >> (64 - (dx & 63));
+                        }
+                    } else {
+                        row[dx >> 6] |= word;
+                    }
+                }
+            }
+        }
+    }
+
+    void clear() override {
+        releaseChunks();
+        board_hash.invalidate();
+    }
+
+    // a soup word is a row of a chunk
+    void populateRandom(const SoupOptions &soup) override {
+        clear();
+        for (size_t cy = 0; cy * CHUNK_SIZE < n; ++cy) {
+            for (size_t cx = 0; cx * CHUNK_SIZE < n; ++cx) {
+                Chunk *chunk = chunk_pool.alloc();
+                for (int y = 0; y < CHUNK_SIZE; ++y) {
+                    size_t row = cy * CHUNK_SIZE + y;
+                    chunk->rows[y] = row < n ? soupWord(soup, row, cx, n) : 0;
+                }
+                if (chunk->empty()) {
+                    chunk_pool.free(chunk);
+                } else {
+                    chunks.emplace(key(cx, cy), chunk);
+                }
+            }
+        }
+    }
+
+    void setAlive(const uint32_t *idxs, size_t len) override {
+        for (size_t i = 0; i < len; ++i) {
+            uint16_t x, y;
+            deinterleaveXY(idxs[i], x, y);
+            if (x < n && y < n) {
+                setCell(x, y, true);
+            }
+        }
+    }
+
+    // only the cells on the board, files deliberately cover just [0, size)
+    void getAlive(std::vector<uint32_t> &idxs) const override {
+        size_t first = idxs.size();
+        for (const auto &entry : chunks) {
+            int64_t x0 = keyX(entry.first) << CHUNK_BITS, y0 = keyY(entry.first) << CHUNK_BITS;
+            for (int y = 0; y < CHUNK_SIZE; ++y) {
+                uint64_t row = entry.second->rows[y];
+                while (row) {
+                    int64_t x = x0 + __builtin_ctzll(row), cy = y0 + y;
+                    if (x >= 0 && cy >= 0 && x < (int64_t)n && cy < (int64_t)n) {
+                        idxs.push_back(interleaveXY(x, cy));
+                    }
+                    row &= row - 1;
+                }
+            }
+        }
+        std::sort(idxs.begin() + first, idxs.end());
+    }
+
+    uint64_t population() const override {
+        uint64_t count = 0;
+        for (const auto &entry : chunks) {
+            for (uint64_t row : entry.second->rows) {
+                count += __builtin_popcountll(row);
+            }
+        }
+        return count;
+    }
+
+    void readDensity(int64_t x0, int64_t y0, size_t w, size_t h, unsigned level,
+            uint32_t *counts) const override
+    {
+        for (const auto &entry : chunks) {
+            int64_t cx = keyX(entry.first) << CHUNK_BITS, cy = keyY(entry.first) << CHUNK_BITS;
+            for (int y = 0; y < CHUNK_SIZE; ++y) {
+                int64_t by = ((cy + y) >> level) - y0;
+                uint64_t row = entry.second->rows[y];
+                if (!row || by < 0 || by >= (int64_t)h) {
+                    continue;
+                }
+                uint32_t *out = counts + by * w;
+                if (level >= CHUNK_BITS) {
+                    // the whole row falls into one block
+                    int64_t bx = (cx >> level) - x0;
+                    if (bx >= 0 && bx < (int64_t)w) {
+                        out[bx] += __builtin_popcountll(row);
+                    }
+                    continue;
+                }
+                while (row) {
+                    int64_t bx = ((cx + __builtin_ctzll(row)) >> level) - x0;
+                    if (bx >= 0 && bx < (int64_t)w) {
+                        ++out[bx];
+                    }
+                    row &= row - 1;
+                }
+            }
+        }
+    }
+
+    // the whole plane, not only the board
+    uint64_t hash() const override {
+        return board_hash.get([&] {
+            uint64_t h = 0;
+            for (const auto &entry : chunks) {
+                h ^= chunkKeys(*entry.second, keyX(entry.first), keyY(entry.first));
+            }
+            return h;
+        });
+    }
+
+    std::unique_ptr<Engine> clone() const override {
+        EngineOptions options;
+        options.rule = life_rule;
+        options.topology = edges;
+        auto copy = std::make_unique<SparseField>(n, options);
+        for (const auto &entry : chunks) {
+            Chunk *chunk = copy->chunk_pool.alloc();
+            *chunk = *entry.second;
+            copy->chunks.emplace(entry.first, chunk);
+        }
+        return copy;
+    }
+
+    size_t chunkCount() const {
+        return chunks.size();
+    }
+
+    uint64_t cellsVisited() const override {
+        return visited_chunks * CHUNK_SIZE * CHUNK_SIZE;
+    }
+
+    // live chunks and the neighbours their edge cells reach are recomputed
+    void step() override {
+        std::vector<uint64_t> candidates;
+        candidates.reserve(chunks.size() * 2);
+        for (const auto &entry : chunks) {
+            const Chunk *c = entry.second;
+            int64_t cx = keyX(entry.first), cy = keyY(entry.first);
+            uint64_t west = 0, east = 0;
+            for (uint64_t row : c->rows) {
+                west |= row & 1;
+                east |= row >> 63;
+            }
+            bool north = c->rows[0], south = c->rows[CHUNK_SIZE - 1];
+            bool edge[3][3] = {
+                {north && (c->rows[0] & 1), north, north && (c->rows[0] >> 63)},
+                {(bool)west, true, (bool)east},
+                {south && (c->rows[CHUNK_SIZE - 1] & 1), south,
+                    south && (c->rows[CHUNK_SIZE - 1] >> 63)},
+            };
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    if (edge[dy + 1][dx + 1]) {
+                        candidates.push_back(key(wrap(cx + dx), wrap(cy + dy)));
+                    }
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        visited_chunks = candidates.size();
+        std::vector<Chunk *> results(candidates.size());
+        for (Chunk *&chunk : results) {
+            chunk = chunk_pool.alloc();
+        }
+        std::atomic<uint64_t> keys{0};
+        auto compute = [&](size_t i) {
+            int64_t cx = keyX(candidates[i]), cy = keyY(candidates[i]);
+            (this->*step_chunk)(cx, cy, results[i]);
+            if (board_hash.tracking()) {
+                Chunk flipped = *results[i];
+                if (const Chunk *old = find(cx, cy)) {
+                    for (int y = 0; y < CHUNK_SIZE; ++y) {
+                        flipped.rows[y] ^= old->rows[y];
+                    }
+                }
+                keys.fetch_xor(chunkKeys(flipped, cx, cy), std::memory_order_relaxed);
+            }
+        };
+        if (pool) {
+            pool->parallelFor(candidates.size(), compute);
+        } else {
+            for (size_t i = 0; i < candidates.size(); ++i) {
+                compute(i);
+            }
+        }
+        releaseChunks();
+        board_hash.flip(keys);
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if (results[i]->empty()) {
+                chunk_pool.free(results[i]);
+            } else {
+                chunks.emplace(candidates[i], results[i]);
+            }
+        }
+    }
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// persistent workers, the calling thread takes part as worker 0
+class ThreadPool {
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::mutex mutex;
+    std::condition_variable start_cv, done_cv;
+    const std::function<void(size_t)> *job = nullptr;
+    uint64_t epoch = 0;
+    size_t finished = 0;
+    bool stopping = false;
+
+    bool pop(size_t id, size_t &task) {
+        Queue &own = *queues[id];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+        // steal from the back of the others
+        for (size_t i = 1; i < queues.size(); ++i) {
+            Queue &other = *queues[(id + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if (!other.tasks.empty()) {
+                task = other.tasks.back();
+                other.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t id) {
+        size_t task;
+        while (pop(id, task)) {
+            (*job)(task);
+        }
+    }
+
+    void worker(size_t id) {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                start_cv.wait(lock, [&] { return stopping || epoch != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = epoch;
+            }
+            run(id);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (++finished == threads.size()) {
+                    done_cv.notify_one();
+                }
+            }
+        }
+    }
+
+public:
+    ThreadPool(size_t n = std::thread::hardware_concurrency()) {
+        n = std::max<size_t>(n, 1);
+        for (size_t i = 0; i < n; ++i) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (size_t i = 1; i < n; ++i) {
+            threads.emplace_back(&ThreadPool::worker, this, i);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start_cv.notify_all();
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const {
+        return queues.size();
+    }
+
+    // runs fn(i) for all i in [0, n) and returns once every call is done,
+    // so consecutive calls are separated by a barrier
+    void parallelFor(size_t n, const std::function<void(size_t)> &fn) {
+        if (threads.empty() || n == 1) {
+            for (size_t i = 0; i < n; ++i) {
+                fn(i);
+            }
+            return;
+        }
+        // contiguous blocks per worker keep neighbouring tasks together
+        size_t workers = queues.size();
+        for (size_t w = 0; w < workers; ++w) {
+            std::lock_guard<std::mutex> lock(queues[w]->mutex);
+            for (size_t i = w * n / workers; i < (w + 1) * n / workers; ++i) {
+                queues[w]->tasks.push_back(i);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            finished = 0;
+            ++epoch;
+        }
+        start_cv.notify_all();
+        run(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [&] { return finished == threads.size(); });
+        job = nullptr;
+    }
+};
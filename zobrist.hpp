@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+// Zobrist hashing of boards: the hash is the xor of a random key per live
+// cell, so flipping a cell flips its key in the hash; keys are derived from
+// the coordinates instead of a table, which would not fit a 65536 board
+inline uint64_t zobristKey(int64_t x, int64_t y) {
+    // splitmix64 finalizer
+    uint64_t z = ((uint64_t)(uint32_t)x << 32 | (uint32_t)y) + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// keys of the cells set in word, bit b is cell (x0 + b, y)
+inline uint64_t zobristWord(uint64_t word, int64_t x0, int64_t y) {
+    uint64_t h = 0;
+    while (word) {
+        h ^= zobristKey(x0 + __builtin_ctzll(word), y);
+        word &= word - 1;
+    }
+    return h;
+}
+
+// the hash of an engine, computed in full the first time it is asked for and
+// then patched by the engine with the cells every step flips; edits only
+// mark it to be computed again
+class TrackedHash {
+    mutable uint64_t value = 0;
+    mutable bool valid = false;
+
+public:
+    template <typename F>
+    uint64_t get(F &&compute) const {
+        if (!valid) {
+            value = compute();
+            valid = true;
+        }
+        return value;
+    }
+
+    bool tracking() const {
+        return valid;
+    }
+
+    void flip(uint64_t keys) {
+        value ^= keys;
+    }
+
+    void invalidate() {
+        valid = false;
+    }
+};